@@ -7,6 +7,7 @@
 #include <linux/cpumask.h>
 #include <linux/seq_file.h>
 #include <linux/proc_fs.h>
+#include <linux/virtio_ring.h>
 #include "virtio_nic.h"
 
 /* Global telemetry instance */
@@ -20,13 +21,6 @@ static struct perf_event *throughput_event;
 
 /* Sysfs attributes */
 static struct kobject *telemetry_kobj;
-static struct kobj_attribute tx_attr;
-static struct kobj_attribute rx_attr;
-static struct kobj_attribute latency_attr;
-static struct kobj_attribute throughput_attr;
-static struct kobj_attribute queue_stats_attr;
-static struct kobj_attribute flow_stats_attr;
-static struct kobj_attribute numa_stats_attr;
 
 /* Statistics tracking */
 static atomic64_t total_tx_packets = ATOMIC64_INIT(0);
@@ -93,14 +87,12 @@ static ssize_t throughput_show(struct kobject *kobj, struct kobj_attribute *attr
     return sprintf(buf, "%llu\n", total_bytes);
 }
 
-/* Enhanced queue statistics */
-static ssize_t queue_stats_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+/* Find the first available priv structure */
+static struct virtio_nic_priv *telemetry_find_priv(void)
 {
     struct virtio_nic_priv *priv = NULL;
-    int i, len = 0;
-    char *pos = buf;
+    int i;
 
-    /* Find the first available priv structure */
     for (i = 0; i < 10; i++) {
         struct net_device *ndev = dev_get_by_name(&init_net, "virtio_nic");
         if (ndev) {
@@ -110,20 +102,476 @@ static ssize_t queue_stats_show(struct kobject *kobj, struct kobj_attribute *att
         }
     }
 
+    return priv;
+}
+
+/*
+ * Per-device tables share one show/store pair: the device is looked up
+ * once here, and a write names a queue the attribute then acts on.
+ */
+struct telemetry_dev_attr {
+    struct kobj_attribute kattr;
+    ssize_t (*show)(struct virtio_nic_priv *priv, char *buf);
+    void (*store)(struct virtio_nic_priv *priv, unsigned int qid);
+};
+
+static ssize_t telemetry_dev_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    struct telemetry_dev_attr *da = container_of(attr, struct telemetry_dev_attr, kattr);
+    struct virtio_nic_priv *priv = telemetry_find_priv();
+
     if (!priv) {
         return sprintf(buf, "No device found\n");
     }
 
+    return da->show(priv, buf);
+}
+
+static ssize_t telemetry_dev_store(struct kobject *kobj, struct kobj_attribute *attr,
+                                   const char *buf, size_t count)
+{
+    struct telemetry_dev_attr *da = container_of(attr, struct telemetry_dev_attr, kattr);
+    struct virtio_nic_priv *priv = telemetry_find_priv();
+    unsigned int qid;
+    int err;
+
+    if (!priv)
+        return -ENODEV;
+
+    err = kstrtouint(buf, 0, &qid);
+    if (err)
+        return err;
+    if (qid >= priv->num_queues)
+        return -EINVAL;
+
+    da->store(priv, qid);
+    return count;
+}
+
+#define TELEMETRY_DEV_ATTR_RO(_name)                                        \
+    static struct telemetry_dev_attr _name##_attr = {                      \
+        .kattr = __ATTR(_name, 0444, telemetry_dev_show, NULL),            \
+        .show = _name##_show,                                              \
+    }
+
+#define TELEMETRY_DEV_ATTR_RW(_name)                                        \
+    static struct telemetry_dev_attr _name##_attr = {                      \
+        .kattr = __ATTR(_name, 0644, telemetry_dev_show, telemetry_dev_store), \
+        .show = _name##_show,                                              \
+        .store = _name##_store,                                            \
+    }
+
+/* Enhanced queue statistics */
+static ssize_t queue_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    int i, len = 0;
+    char *pos = buf;
+
     len += sprintf(pos + len, "Queue Statistics:\n");
     len += sprintf(pos + len, "Queue\tNUMA\tCPU\tRX_Pkts\tTX_Pkts\tRX_Bytes\tTX_Bytes\tPending\n");
 
     for (i = 0; i < priv->num_queues; i++) {
-        struct virtio_nic_queue *q = &priv->queues[i];
+        struct virtio_nic_queue_stats qs;
+
+        virtio_nic_get_queue_stats(&priv->queues[i], &qs);
         len += sprintf(pos + len, "%d\t%d\t%d\t%llu\t%llu\t%llu\t%llu\t%d\n",
-                      i, q->numa_node, q->cpu_id,
-                      q->rx_packets, q->tx_packets,
-                      q->rx_bytes, q->tx_bytes,
-                      atomic_read(&q->pending_packets));
+                      i, qs.numa_node, qs.cpu_id,
+                      qs.rx_packets, qs.tx_packets,
+                      qs.rx_bytes, qs.tx_bytes,
+                      qs.pending_packets);
+    }
+
+    return len;
+}
+
+/* Doorbell batching statistics: how many TX packets each VM exit covered */
+static ssize_t tx_kick_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "TX Kick Statistics:\n");
+    len += sprintf(pos + len, "Queue\tKicks\tKicked_Pkts\tPkts_per_Kick\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+        u64 kicks = q->tx_kicks;
+        u64 pkts = q->tx_kick_packets;
+
+        len += sprintf(pos + len, "%d\t%llu\t%llu\t%llu\n",
+                      i, kicks, pkts, kicks > 0 ? div64_u64(pkts, kicks) : 0);
+    }
+
+    return len;
+}
+
+/* Interrupts per queue against the packets they covered */
+static ssize_t irq_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_queue_stats qs;
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "Interrupt Statistics (event index %s):\n",
+                  virtio_has_feature(priv->vdev, VIRTIO_RING_F_EVENT_IDX) ? "on" : "off");
+    len += sprintf(pos + len, "Queue\tRX_IRQs\tTX_IRQs\tPackets\tPkts_per_IRQ\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+        u64 irqs = READ_ONCE(q->rx_irqs) + READ_ONCE(q->tx_irqs);
+        u64 pkts;
+
+        virtio_nic_get_queue_stats(q, &qs);
+        pkts = qs.rx_packets + qs.tx_packets;
+
+        len += sprintf(pos + len, "%d\t%llu\t%llu\t%llu\t%llu\n",
+                      i, READ_ONCE(q->rx_irqs), READ_ONCE(q->tx_irqs), pkts,
+                      irqs > 0 ? div64_u64(pkts, irqs) : 0);
+    }
+
+    return len;
+}
+
+/* TX completion cost per packet, and whether in-order reclaim is active */
+static ssize_t tx_completion_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "TX Completion Statistics:\n");
+    len += sprintf(pos + len, "Queue\tIn_Order\tCompleted\tReclaim_ns\tns_per_Pkt\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+        u64 done = READ_ONCE(q->tx_completed);
+        u64 ns = READ_ONCE(q->tx_reclaim_ns);
+
+        len += sprintf(pos + len, "%d\t%d\t%llu\t%llu\t%llu\n",
+                      i, q->tx_in_order, done, ns, done > 0 ? div64_u64(ns, done) : 0);
+    }
+
+    return len;
+}
+
+/* RX buffer sizing: mergeable EWMA and posted ring memory per queue */
+static ssize_t rx_buf_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "RX Buffer Statistics:\n");
+    len += sprintf(pos + len, "Queue\tMergeable\tAvg_Pkt_Len\tBuf_Len\tRing_Bytes\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+        unsigned int buf_len = priv->mergeable_rx_bufs ?
+                               virtio_nic_rx_mrg_len(q) : q->rx_buf_len;
+
+        len += sprintf(pos + len, "%d\t%d\t%lu\t%u\t%llu\n",
+                      i, priv->mergeable_rx_bufs,
+                      ewma_pkt_len_read(&q->mrg_avg_pkt_len), buf_len,
+                      (u64)q->rx_ring_size * buf_len);
+    }
+
+    return len;
+}
+
+/* XDP verdict counts per RX queue */
+static ssize_t xdp_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_queue_stats qs;
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "XDP Statistics (%u TX queues):\n", priv->num_xdp_sqs);
+    len += sprintf(pos + len, "Queue\tPackets\tDrops\tTX\tRedirects\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        virtio_nic_get_queue_stats(&priv->queues[i], &qs);
+
+        len += sprintf(pos + len, "%d\t%llu\t%llu\t%llu\t%llu\n",
+                      i, qs.xdp_packets, qs.xdp_drops, qs.xdp_tx,
+                      qs.xdp_redirects);
+    }
+
+    return len;
+}
+
+/* Share of RX packets that arrived with a device-reported hash */
+static ssize_t rx_hash_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_queue_stats qs;
+    u64 permille;
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "RX Hash Statistics (report %s):\n",
+                  priv->has_hash_report ? "negotiated" : "unavailable");
+    len += sprintf(pos + len, "Queue\tPackets\tHashed\tHashed_Pct\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        virtio_nic_get_queue_stats(&priv->queues[i], &qs);
+
+        permille = qs.rx_packets ? div64_u64(qs.rx_hashed * 1000, qs.rx_packets) : 0;
+        len += sprintf(pos + len, "%d\t%llu\t%llu\t%llu.%llu\n",
+                      i, qs.rx_packets, qs.rx_hashed, permille / 10, permille % 10);
+    }
+
+    return len;
+}
+
+/* Packets whose checksum the device handled versus the CPU, per queue */
+static ssize_t csum_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_queue_stats qs;
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "Checksum Offload Statistics:\n");
+    len += sprintf(pos + len, "Queue\tRX_Offload\tRX_Software\tTX_Offload\tTX_Software\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        virtio_nic_get_queue_stats(&priv->queues[i], &qs);
+
+        len += sprintf(pos + len, "%d\t%llu\t%llu\t%llu\t%llu\n",
+                      i, qs.rx_csum_offload, qs.rx_csum_sw,
+                      qs.tx_csum_offload, qs.tx_csum_sw);
+    }
+
+    return len;
+}
+
+/* TX packets copied into the slab rather than sent from the skb, per queue */
+static ssize_t tx_copybreak_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_queue_stats qs;
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "TX Copy-Break Statistics:\n");
+    len += sprintf(pos + len, "Queue\tThreshold\tPackets\tCopied\tCopied_Pct\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        virtio_nic_get_queue_stats(&priv->queues[i], &qs);
+
+        len += sprintf(pos + len, "%d\t%u\t%llu\t%llu\t%llu\n",
+                      i, priv->queues[i].tx_copybreak, qs.tx_packets, qs.tx_copybreak,
+                      qs.tx_packets > 0 ? div64_u64(qs.tx_copybreak * 100, qs.tx_packets) : 0);
+    }
+
+    return len;
+}
+
+/* RX frames copied out so their buffer went straight back to the ring */
+static ssize_t rx_copybreak_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_queue_stats qs;
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "RX Copy-Break Statistics (threshold %u):\n",
+                   READ_ONCE(priv->rx_copybreak));
+    len += sprintf(pos + len, "Queue\tPackets\tCopied\tCopied_Pct\tRing_Free\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        virtio_nic_get_queue_stats(&priv->queues[i], &qs);
+
+        len += sprintf(pos + len, "%d\t%llu\t%llu\t%llu\t%u\n",
+                      i, qs.rx_packets, qs.rx_copybreak,
+                      qs.rx_packets > 0 ? div64_u64(qs.rx_copybreak * 100, qs.rx_packets) : 0,
+                      priv->queues[i].rx_vq ? priv->queues[i].rx_vq->num_free : 0);
+    }
+
+    return len;
+}
+
+/* TX ring slots per packet (1.00 with indirect tables) and full-ring stops */
+static ssize_t tx_ring_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_queue_stats qs;
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "TX Ring Statistics (indirect descriptors %s):\n",
+                   virtio_has_feature(priv->vdev, VIRTIO_RING_F_INDIRECT_DESC) ? "on" : "off");
+    len += sprintf(pos + len, "Queue\tRing_Size\tPackets\tDescriptors\tDescs_per_Pkt\tStops\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+        u64 descs = READ_ONCE(q->tx_descs);
+        u64 per_pkt;
+
+        virtio_nic_get_queue_stats(q, &qs);
+        per_pkt = qs.tx_packets > 0 ? div64_u64(descs * 100, qs.tx_packets) : 0;
+
+        len += sprintf(pos + len, "%d\t%u\t%llu\t%llu\t%llu.%02llu\t%llu\n",
+                      i, q->tx_ring_size, qs.tx_packets, descs,
+                      per_pkt / 100, per_pkt % 100, READ_ONCE(q->tx_stops));
+    }
+
+    return len;
+}
+
+/* Control virtqueue: commands per doorbell shows how well updates batch */
+static ssize_t ctrl_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    u64 cmds, kicks, failed;
+    unsigned int inflight;
+    unsigned long flags;
+    int len = 0;
+    char *pos = buf;
+
+    spin_lock_irqsave(&priv->ctrl_vq_lock, flags);
+    cmds = priv->ctrl_cmds;
+    kicks = priv->ctrl_kicks;
+    failed = priv->ctrl_failed;
+    inflight = priv->ctrl_inflight;
+    spin_unlock_irqrestore(&priv->ctrl_vq_lock, flags);
+
+    len += sprintf(pos + len, "Control Queue Statistics:\n");
+    len += sprintf(pos + len, "Commands\tKicks\tCmds_per_Kick\tFailed\tInflight\n");
+    len += sprintf(pos + len, "%llu\t%llu\t%llu\t%llu\t%u\n",
+                  cmds, kicks, kicks > 0 ? div64_u64(cmds, kicks) : 0, failed, inflight);
+
+    return len;
+}
+
+/* Which pairs are live after ethtool -L, where their interrupts land and their load */
+static ssize_t channel_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_queue_stats qs;
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "Channel Statistics (%u of %u active, %llu changes, last %llu us):\n",
+                   READ_ONCE(priv->active_queues), priv->num_queues,
+                   READ_ONCE(priv->channel_changes),
+                   div_u64(READ_ONCE(priv->channel_change_ns), NSEC_PER_USEC));
+    len += sprintf(pos + len, "Queue\tActive\tCPU\tRX_Packets\tTX_Packets\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+
+        virtio_nic_get_queue_stats(q, &qs);
+        len += sprintf(pos + len, "%d\t%d\t%d\t%llu\t%llu\n",
+                      i, i < READ_ONCE(priv->active_queues), q->cpu_id,
+                      qs.rx_packets, qs.tx_packets);
+    }
+
+    return len;
+}
+
+/* Ring depth and the memory each queue pair holds at it, after ethtool -G */
+static ssize_t ring_mem_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_queue_mem mem;
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "Ring Memory Statistics:\n");
+    len += sprintf(pos + len, "Queue\tRX_Ring\tTX_Ring\tVring_Bytes\tRX_Buf_Bytes\tTX_Slot_Bytes\tTotal_Bytes\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+        u64 vring, sum;
+
+        virtio_nic_get_queue_mem(q, &mem);
+        vring = mem.rx_vring_bytes + mem.tx_vring_bytes;
+        sum = vring + mem.rx_buf_bytes + mem.tx_slot_bytes;
+
+        len += sprintf(pos + len, "%d\t%u\t%u\t%llu\t%llu\t%llu\t%llu\n",
+                      i, q->rx_ring_size, q->tx_ring_size, vring,
+                      mem.rx_buf_bytes, mem.tx_slot_bytes, sum);
+    }
+
+    return len;
+}
+
+/* Per-queue ring resets and how long each queue was out of service */
+static ssize_t queue_reset_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    int i, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "Queue Reset Statistics:\n");
+    len += sprintf(pos + len, "Queue\tResets\tFailed\tLast_us\tMax_us\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+
+        len += sprintf(pos + len, "%d\t%llu\t%llu\t%llu\t%llu\n",
+                      i, READ_ONCE(q->resets), READ_ONCE(q->reset_failed),
+                      div_u64(READ_ONCE(q->reset_ns), NSEC_PER_USEC),
+                      div_u64(READ_ONCE(q->reset_ns_max), NSEC_PER_USEC));
+    }
+
+    return len;
+}
+
+/* Writing a queue number resets that queue, as the failover path would */
+static void queue_reset_stats_store(struct virtio_nic_priv *priv, unsigned int qid)
+{
+    schedule_work(&priv->queues[qid].failover_work);
+}
+
+/* TX steering around failed queues: what is failed, where it goes, flows pinned */
+static ssize_t tx_steer_stats_show(struct virtio_nic_priv *priv, char *buf)
+{
+    struct virtio_nic_tx_steer *steer;
+    int i, j, len = 0;
+    char *pos = buf;
+
+    rcu_read_lock();
+    steer = rcu_dereference(priv->tx_steer);
+
+    len += sprintf(pos + len, "TX Steering Statistics (%u flow overrides):\n",
+                   steer ? steer->nr_overrides : 0);
+    len += sprintf(pos + len, "Queue\tFailed\tRedirect\tPinned_Flows\tSteered_Away\n");
+
+    for (i = 0; i < priv->num_queues; i++) {
+        bool failed = steer && test_bit(i, steer->failed);
+        unsigned int pinned = 0;
+
+        for (j = 0; steer && j < VIRTIO_NIC_FLOW_OVERRIDES; j++)
+            pinned += steer->flows[j].valid && steer->flows[j].to == i;
+
+        len += sprintf(pos + len, "%d\t%d\t%d\t%u\t%ld\n",
+                      i, failed, failed ? steer->redirect[i] : i, pinned,
+                      atomic_long_read(&priv->queues[i].tx_steered));
+    }
+
+    rcu_read_unlock();
+    return len;
+}
+
+/* Writing a queue number fails it as a TX timeout would: steer away, then reset */
+static void tx_steer_stats_store(struct virtio_nic_priv *priv, unsigned int qid)
+{
+    virtio_nic_queue_mark_failed(priv, qid);
+    schedule_work(&priv->queues[qid].failover_work);
+}
+
+/* RX packets per RSS indirection bucket, to spot hot buckets */
+static ssize_t rss_buckets_show(struct virtio_nic_priv *priv, char *buf)
+{
+    int i, j, len = 0;
+    char *pos = buf;
+
+    len += sprintf(pos + len, "RSS Bucket Statistics:\n");
+    len += sprintf(pos + len, "Bucket\tQueue\tPackets\n");
+
+    if (!priv->has_rss)
+        return len;
+
+    for (i = 0; i < priv->rss_table_size; i++) {
+        u64 hits = 0;
+
+        for (j = 0; j < priv->num_queues; j++) {
+            if (priv->queues[j].rss_bucket_hits)
+                hits += READ_ONCE(priv->queues[j].rss_bucket_hits[i]);
+        }
+
+        len += sprintf(pos + len, "%d\t%u\t%llu\n", i, priv->rss_indir[i], hits);
     }
 
     return len;
@@ -173,6 +621,62 @@ static ssize_t numa_stats_show(struct kobject *kobj, struct kobj_attribute *attr
     return len;
 }
 
+/* Sysfs attribute table, in the order the files appear */
+static struct kobj_attribute tx_attr = __ATTR(tx_packets, 0444, tx_show, NULL);
+static struct kobj_attribute rx_attr = __ATTR(rx_packets, 0444, rx_show, NULL);
+static struct kobj_attribute latency_attr = __ATTR(avg_latency_ns, 0444, latency_show, NULL);
+static struct kobj_attribute throughput_attr = __ATTR(total_bytes, 0444, throughput_show, NULL);
+static struct kobj_attribute flow_stats_attr = __ATTR(flow_stats, 0444, flow_stats_show, NULL);
+static struct kobj_attribute numa_stats_attr = __ATTR(numa_stats, 0444, numa_stats_show, NULL);
+TELEMETRY_DEV_ATTR_RO(queue_stats);
+TELEMETRY_DEV_ATTR_RO(tx_kick_stats);
+TELEMETRY_DEV_ATTR_RO(rx_buf_stats);
+TELEMETRY_DEV_ATTR_RO(xdp_stats);
+TELEMETRY_DEV_ATTR_RO(rss_buckets);
+TELEMETRY_DEV_ATTR_RO(rx_hash_stats);
+TELEMETRY_DEV_ATTR_RO(csum_stats);
+TELEMETRY_DEV_ATTR_RO(irq_stats);
+TELEMETRY_DEV_ATTR_RO(tx_completion_stats);
+TELEMETRY_DEV_ATTR_RO(tx_copybreak_stats);
+TELEMETRY_DEV_ATTR_RO(rx_copybreak_stats);
+TELEMETRY_DEV_ATTR_RO(tx_ring_stats);
+TELEMETRY_DEV_ATTR_RO(ctrl_stats);
+TELEMETRY_DEV_ATTR_RO(channel_stats);
+TELEMETRY_DEV_ATTR_RO(ring_mem_stats);
+TELEMETRY_DEV_ATTR_RW(queue_reset_stats);
+TELEMETRY_DEV_ATTR_RW(tx_steer_stats);
+
+static struct attribute *telemetry_attrs[] = {
+    &tx_attr.attr,
+    &rx_attr.attr,
+    &latency_attr.attr,
+    &throughput_attr.attr,
+    &queue_stats_attr.kattr.attr,
+    &flow_stats_attr.attr,
+    &numa_stats_attr.attr,
+    &tx_kick_stats_attr.kattr.attr,
+    &rx_buf_stats_attr.kattr.attr,
+    &xdp_stats_attr.kattr.attr,
+    &rss_buckets_attr.kattr.attr,
+    &rx_hash_stats_attr.kattr.attr,
+    &csum_stats_attr.kattr.attr,
+    &irq_stats_attr.kattr.attr,
+    &tx_completion_stats_attr.kattr.attr,
+    &tx_copybreak_stats_attr.kattr.attr,
+    &rx_copybreak_stats_attr.kattr.attr,
+    &tx_ring_stats_attr.kattr.attr,
+    &ctrl_stats_attr.kattr.attr,
+    &channel_stats_attr.kattr.attr,
+    &ring_mem_stats_attr.kattr.attr,
+    &queue_reset_stats_attr.kattr.attr,
+    &tx_steer_stats_attr.kattr.attr,
+    NULL,
+};
+
+static const struct attribute_group telemetry_attr_group = {
+    .attrs = telemetry_attrs,
+};
+
 /* Initialize telemetry system */
 void telemetry_init(struct net_device *ndev)
 {
@@ -196,42 +700,9 @@ void telemetry_init(struct net_device *ndev)
 
     /* Create sysfs interface */
     telemetry_kobj = kobject_create_and_add("virtio_nic_telemetry", &ndev->dev.kobj);
-    if (telemetry_kobj) {
-        /* Setup attributes */
-        tx_attr.attr.name = "tx_packets";
-        tx_attr.attr.mode = 0444;
-        tx_attr.show = tx_show;
-        sysfs_create_file(telemetry_kobj, &tx_attr.attr);
-
-        rx_attr.attr.name = "rx_packets";
-        rx_attr.attr.mode = 0444;
-        rx_attr.show = rx_show;
-        sysfs_create_file(telemetry_kobj, &rx_attr.attr);
-
-        latency_attr.attr.name = "avg_latency_ns";
-        latency_attr.attr.mode = 0444;
-        latency_attr.show = latency_show;
-        sysfs_create_file(telemetry_kobj, &latency_attr.attr);
-
-        throughput_attr.attr.name = "total_bytes";
-        throughput_attr.attr.mode = 0444;
-        throughput_attr.show = throughput_show;
-        sysfs_create_file(telemetry_kobj, &throughput_attr.attr);
-
-        queue_stats_attr.attr.name = "queue_stats";
-        queue_stats_attr.attr.mode = 0444;
-        queue_stats_attr.show = queue_stats_show;
-        sysfs_create_file(telemetry_kobj, &queue_stats_attr.attr);
-
-        flow_stats_attr.attr.name = "flow_stats";
-        flow_stats_attr.attr.mode = 0444;
-        flow_stats_attr.show = flow_stats_show;
-        sysfs_create_file(telemetry_kobj, &flow_stats_attr.attr);
-
-        numa_stats_attr.attr.name = "numa_stats";
-        numa_stats_attr.attr.mode = 0444;
-        numa_stats_attr.show = numa_stats_show;
-        sysfs_create_file(telemetry_kobj, &numa_stats_attr.attr);
+    if (telemetry_kobj && sysfs_create_group(telemetry_kobj, &telemetry_attr_group)) {
+        kobject_put(telemetry_kobj);
+        telemetry_kobj = NULL;
     }
 
     /* Initialize NUMA statistics */
@@ -300,18 +771,22 @@ EXPORT_SYMBOL_GPL(telemetry_record_latency);
 
 void telemetry_update_queue_stats(struct virtio_nic_queue *q)
 {
+    struct virtio_nic_queue_stats qs;
+
     if (!q)
         return;
 
     /* Update NUMA statistics */
     if (q->numa_node < num_possible_nodes()) {
         struct virtio_nic_numa_stats *stats = &numa_stats[q->numa_node];
-        stats->rx_packets += q->rx_packets;
-        stats->tx_packets += q->tx_packets;
-        stats->rx_bytes += q->rx_bytes;
-        stats->tx_bytes += q->tx_bytes;
-        stats->rx_errors += q->rx_errors;
-        stats->tx_errors += q->tx_errors;
+
+        virtio_nic_get_queue_stats(q, &qs);
+        stats->rx_packets += qs.rx_packets;
+        stats->tx_packets += qs.tx_packets;
+        stats->rx_bytes += qs.rx_bytes;
+        stats->tx_bytes += qs.tx_bytes;
+        stats->rx_errors += qs.rx_errors;
+        stats->tx_errors += qs.tx_errors;
     }
 }
 EXPORT_SYMBOL_GPL(telemetry_update_queue_stats);
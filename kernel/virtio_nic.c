@@ -1,6 +1,7 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/virtio_config.h>
+#include <linux/virtio_ring.h>
 #include <linux/numa.h>
 #include <linux/cpumask.h>
 #include <linux/timer.h>
@@ -14,7 +15,14 @@ static const struct net_device_ops virtio_nic_netdev_ops = {
     .ndo_open       = virtio_nic_open,
     .ndo_stop       = virtio_nic_stop,
     .ndo_start_xmit = virtio_nic_start_xmit,
-    .ndo_get_stats  = virtio_nic_get_stats,
+    .ndo_select_queue = virtio_nic_select_queue,
+    .ndo_tx_timeout = virtio_nic_tx_timeout,
+    .ndo_get_stats64 = virtio_nic_get_stats64,
+    .ndo_set_features = virtio_nic_set_features,
+    .ndo_set_rx_mode = virtio_nic_set_rx_mode,
+    .ndo_bpf        = virtio_nic_bpf,
+    .ndo_xdp_xmit   = virtio_nic_xdp_xmit,
+    .ndo_xsk_wakeup = virtio_nic_xsk_wakeup,
 };
 
 /* Global telemetry instance */
@@ -26,26 +34,52 @@ static int numa_node = -1;
 static int coalesce_usecs = VIRTIO_NIC_COALESCE_USECS;
 static bool enable_zero_copy = true;
 static bool enable_numa_aware = true;
+static int tx_kick_batch = VIRTIO_NIC_TX_KICK_BATCH;
+static bool enable_packed_ring = true;
+static bool enable_event_idx = true;
+static bool enable_in_order = true;
+static bool enable_indirect_desc = true;
 
 module_param(num_queues, int, 0644);
 module_param(numa_node, int, 0644);
 module_param(coalesce_usecs, int, 0644);
 module_param(enable_zero_copy, bool, 0644);
 module_param(enable_numa_aware, bool, 0644);
+module_param(tx_kick_batch, int, 0644);
+module_param(enable_packed_ring, bool, 0444);
+module_param(enable_event_idx, bool, 0444);
+module_param(enable_in_order, bool, 0444);
+module_param(enable_indirect_desc, bool, 0444);
 
 MODULE_PARM_DESC(num_queues, "Number of queues (default: 32)");
 MODULE_PARM_DESC(numa_node, "NUMA node to bind to (-1 for auto)");
 MODULE_PARM_DESC(coalesce_usecs, "Interrupt coalescing time in usecs");
-MODULE_PARM_DESC(enable_zero_copy, "Enable zero-copy DMA (default: true)");
+MODULE_PARM_DESC(enable_zero_copy, "Ignored: TX always sends from the skb's pages, mapped by the virtio core");
 MODULE_PARM_DESC(enable_numa_aware, "Enable NUMA-aware scheduling (default: true)");
+MODULE_PARM_DESC(tx_kick_batch, "Max TX packets per doorbell under xmit_more (0: kick every packet)");
+MODULE_PARM_DESC(enable_packed_ring, "Use packed virtqueues when the device offers them (default: true)");
+MODULE_PARM_DESC(enable_event_idx, "Use event-index notification suppression when offered (default: true)");
+MODULE_PARM_DESC(enable_in_order, "Use in-order TX completion when offered (default: true)");
+MODULE_PARM_DESC(enable_indirect_desc, "Use indirect descriptor tables when offered (default: true)");
 
 static int virtio_nic_probe(struct virtio_device *vdev)
 {
     struct net_device *ndev;
     struct virtio_nic_priv *priv;
+    unsigned int nq, max_pairs = 1;
+    bool has_cvq;
     int err;
 
-    ndev = alloc_etherdev(sizeof(*priv));
+    /* Multiple pairs need the control vq to tell the device to use them */
+    has_cvq = virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_VQ);
+    if (has_cvq && virtio_has_feature(vdev, VIRTIO_NET_F_MQ))
+        max_pairs = virtio_cread16(vdev, offsetof(struct virtio_net_config,
+                                                  max_virtqueue_pairs));
+
+    /* One netdev TX/RX queue per driver queue so the stack picks the queue */
+    nq = clamp_t(unsigned int, num_queues, 1, min_t(unsigned int, max_pairs,
+                                                    VIRTIO_NIC_MAX_QUEUES));
+    ndev = alloc_etherdev_mqs(sizeof(*priv), nq, nq);
     if (!ndev)
         return -ENOMEM;
 
@@ -53,17 +87,82 @@ static int virtio_nic_probe(struct virtio_device *vdev)
     memset(priv, 0, sizeof(*priv));
     priv->vdev = vdev;
     priv->netdev = ndev;
-    priv->num_queues = num_queues;
+    priv->num_queues = nq;
     priv->active_queues = 0;
     priv->numa_node = numa_node;
+    priv->has_cvq = has_cvq;
+    priv->has_mq = has_cvq && virtio_has_feature(vdev, VIRTIO_NET_F_MQ);
+    priv->has_ctrl_rx = has_cvq && virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_RX);
+    priv->has_notf_coal = has_cvq && virtio_has_feature(vdev, VIRTIO_NET_F_NOTF_COAL);
+    priv->has_vq_notf_coal = has_cvq && virtio_has_feature(vdev, VIRTIO_NET_F_VQ_NOTF_COAL);
+    priv->max_queue_pairs = max_pairs;
     
-    spin_lock_init(&priv->stats_lock);
     atomic_set(&priv->failover_count, 0);
+    spin_lock_init(&priv->tx_steer_lock);
+    INIT_DELAYED_WORK(&priv->refill_work, virtio_nic_rx_refill_work);
+
+    /* Modern devices always prepend the mergeable-layout header */
+    priv->mergeable_rx_bufs = virtio_has_feature(vdev, VIRTIO_NET_F_MRG_RXBUF);
+    if (virtio_has_feature(vdev, VIRTIO_NET_F_HASH_REPORT))
+        priv->hdr_len = sizeof(struct virtio_net_hdr_v1_hash);
+    else if (priv->mergeable_rx_bufs || virtio_has_feature(vdev, VIRTIO_F_VERSION_1))
+        priv->hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+    else
+        priv->hdr_len = sizeof(struct virtio_net_hdr);
+    priv->rx_copybreak = VIRTIO_NIC_RX_COPYBREAK;
+    priv->has_hash_report = has_cvq && virtio_has_feature(vdev, VIRTIO_NET_F_HASH_REPORT);
 
     ndev->netdev_ops = &virtio_nic_netdev_ops;
+    /* The device filters extra unicast addresses itself, no promisc needed */
+    if (priv->has_ctrl_rx)
+        ndev->priv_flags |= IFF_UNICAST_FLT;
+    virtio_nic_set_ethtool_ops(ndev);
+
+    /* TX offloads the device will honour from the virtio_net_hdr */
+    if (virtio_has_feature(vdev, VIRTIO_NET_F_CSUM)) {
+        ndev->hw_features |= NETIF_F_HW_CSUM | NETIF_F_SG;
+        if (virtio_has_feature(vdev, VIRTIO_NET_F_HOST_TSO4))
+            ndev->hw_features |= NETIF_F_TSO;
+        if (virtio_has_feature(vdev, VIRTIO_NET_F_HOST_TSO6))
+            ndev->hw_features |= NETIF_F_TSO6;
+        if (virtio_has_feature(vdev, VIRTIO_NET_F_HOST_ECN))
+            ndev->hw_features |= NETIF_F_TSO_ECN;
+        if (virtio_has_feature(vdev, VIRTIO_NET_F_HOST_USO))
+            ndev->hw_features |= NETIF_F_GSO_UDP_L4;
+        ndev->features |= ndev->hw_features;
+        ndev->vlan_features = ndev->features;
+    }
+
+    /* Let the device vouch for, or finish, RX checksums */
+    if (virtio_has_feature(vdev, VIRTIO_NET_F_GUEST_CSUM)) {
+        ndev->hw_features |= NETIF_F_RXCSUM;
+        ndev->features |= NETIF_F_RXCSUM;
+    }
+
+    /* Host-coalesced RX segments arrive as GSO skbs of up to 64KB */
+    priv->guest_offloads = vdev->features & (VIRTIO_NIC_GUEST_GSO_OFFLOADS |
+                                             BIT_ULL(VIRTIO_NET_F_GUEST_CSUM));
+    priv->has_offloads_ctrl = has_cvq &&
+                              virtio_has_feature(vdev, VIRTIO_NET_F_CTRL_GUEST_OFFLOADS);
+    if (priv->guest_offloads & VIRTIO_NIC_GUEST_GSO_OFFLOADS) {
+        ndev->features |= NETIF_F_GRO_HW;
+        if (priv->has_offloads_ctrl)
+            ndev->hw_features |= NETIF_F_GRO_HW;
+    }
     SET_NETDEV_DEV(ndev, &vdev->dev);
     vdev->priv = priv;
 
+    err = virtio_nic_ctrl_init(priv);
+    if (err)
+        goto free_netdev;
+    virtio_nic_rss_probe(priv);
+
+    /* A device-supplied hash spares RPS/RFS a software flow dissection */
+    if (priv->has_hash_report) {
+        ndev->hw_features |= NETIF_F_RXHASH;
+        ndev->features |= NETIF_F_RXHASH;
+    }
+
     /* Initialize NUMA-aware setup */
     if (enable_numa_aware) {
         err = virtio_nic_numa_setup(priv);
@@ -80,6 +179,21 @@ static int virtio_nic_probe(struct virtio_device *vdev)
         goto cleanup_numa;
     }
 
+    err = netif_set_real_num_tx_queues(ndev, priv->active_queues);
+    if (!err)
+        err = netif_set_real_num_rx_queues(ndev, priv->active_queues);
+    if (err) {
+        dev_err(&vdev->dev, "Failed to set real queue count: %d\n", err);
+        goto teardown_queues;
+    }
+
+    /* Redirect-in needs the XDP TX rings; without them XDP_TX drops */
+    ndev->xdp_features = NETDEV_XDP_ACT_BASIC | NETDEV_XDP_ACT_REDIRECT;
+    if (priv->num_xdp_sqs)
+        ndev->xdp_features |= NETDEV_XDP_ACT_NDO_XMIT;
+    if (virtio_has_feature(vdev, VIRTIO_F_RING_RESET))
+        ndev->xdp_features |= NETDEV_XDP_ACT_XSK_ZEROCOPY;
+
     /* Setup MSI-X interrupts */
     err = virtio_nic_setup_msix(priv);
     if (err) {
@@ -100,20 +214,35 @@ static int virtio_nic_probe(struct virtio_device *vdev)
     }
 
     virtio_device_ready(vdev);
+
+    /* Steer RX over every active queue; without it the device uses pair 0 */
+    rtnl_lock();
+    err = virtio_nic_rss_init(priv);
+    if (!err && !priv->has_rss)
+        err = virtio_nic_set_queue_pairs(priv, priv->active_queues);
+    rtnl_unlock();
+    if (err)
+        dev_warn(&vdev->dev, "RX steering setup failed: %d\n", err);
     
-    dev_info(&vdev->dev, "VirtIO NIC driver initialized with %d queues on NUMA %d\n",
-             priv->num_queues, priv->numa_node);
+    dev_info(&vdev->dev, "VirtIO NIC driver initialized with %d %s%s queues on NUMA %d\n",
+             priv->num_queues,
+             virtio_has_feature(vdev, VIRTIO_F_RING_PACKED) ? "packed" : "split",
+             virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) ? "+indirect" : "",
+             priv->numa_node);
     
     return 0;
 
 cleanup_failover:
     virtio_nic_cleanup_failover(priv);
 teardown_queues:
+    /* Buffers may already be posted; the device must let go of them first */
+    virtio_reset_device(vdev);
     virtio_nic_teardown_queues(priv);
 cleanup_numa:
     if (enable_numa_aware)
         virtio_nic_bind_to_numa(priv, -1);
 free_netdev:
+    virtio_nic_ctrl_cleanup(priv);
     free_netdev(ndev);
     return err;
 }
@@ -121,17 +250,35 @@ free_netdev:
 static void virtio_nic_remove(struct virtio_device *vdev)
 {
     struct virtio_nic_priv *priv = vdev->priv;
+    int i;
 
     if (!priv)
         return;
 
+    /* Close the device (stopping NAPI and refill) before freeing queues */
+    unregister_netdev(priv->netdev);
+
     telemetry_exit();
+
+    /*
+     * A queue reset in progress still uses the failover state.  With the
+     * netdev and telemetry gone only the health check could queue another,
+     * so stop it first, then wait for the resets before freeing the state.
+     */
+    virtio_nic_stop_failover(priv);
+    for (i = 0; i < priv->num_queues; i++)
+        cancel_work_sync(&priv->queues[i].failover_work);
     virtio_nic_cleanup_failover(priv);
+
+    /* Stop all DMA before posted buffers are detached and freed */
+    virtio_reset_device(vdev);
+
     virtio_nic_free_irqs(priv);
+    virtio_nic_rss_cleanup(priv);
     virtio_nic_teardown_queues(priv);
+    virtio_nic_ctrl_cleanup(priv);
     if (enable_numa_aware)
         virtio_nic_bind_to_numa(priv, -1);
-    unregister_netdev(priv->netdev);
     free_netdev(priv->netdev);
 }
 
@@ -145,12 +292,14 @@ int virtio_nic_open(struct net_device *ndev)
         virtio_nic_adaptive_scheduling(priv);
 
     /* Enable all queues */
-    for (i = 0; i < priv->num_queues; i++) {
+    for (i = 0; i < priv->active_queues; i++) {
+        /* Post RX buffers before the device can deliver anything */
+        if (!virtio_nic_rx_refill(&priv->queues[i], GFP_KERNEL))
+            schedule_delayed_work(&priv->refill_work, 0);
         napi_enable(&priv->queues[i].napi);
-        netif_napi_add(ndev, &priv->queues[i].napi, virtio_nic_poll, VIRTIO_NIC_NAPI_WEIGHT);
     }
 
-    netif_start_queue(ndev);
+    netif_tx_start_all_queues(ndev);
     return 0;
 }
 
@@ -159,141 +308,317 @@ int virtio_nic_stop(struct net_device *ndev)
     struct virtio_nic_priv *priv = netdev_priv(ndev);
     int i;
 
-    netif_stop_queue(ndev);
+    netif_tx_disable(ndev);
+
+    /* The refill worker toggles NAPI, so stop it first */
+    cancel_delayed_work_sync(&priv->refill_work);
 
     /* Disable all queues */
-    for (i = 0; i < priv->num_queues; i++) {
-        netif_napi_del(&priv->queues[i].napi);
+    for (i = 0; i < priv->active_queues; i++)
         napi_disable(&priv->queues[i].napi);
-    }
 
     return 0;
 }
 
+/* rx-gro-hw switches device RX coalescing on and off through the ctrl vq */
+int virtio_nic_set_features(struct net_device *ndev, netdev_features_t features)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    u64 offloads = priv->guest_offloads;
+
+    if (!((ndev->features ^ features) & NETIF_F_GRO_HW))
+        return 0;
+
+    /* XDP only sees single buffers, so coalescing stays off while it runs */
+    if (priv->xdp_enabled)
+        return -EBUSY;
+
+    if (!(features & NETIF_F_GRO_HW))
+        offloads &= ~VIRTIO_NIC_GUEST_GSO_OFFLOADS;
+
+    return virtio_nic_set_guest_offloads(priv, offloads);
+}
+
+/*
+ * Describe @skb's GSO and checksum state in the slot's virtio_net_hdr so
+ * the device segments TSO/USO super-packets itself.
+ */
+static int virtio_nic_tx_hdr(struct virtio_nic_priv *priv, struct sk_buff *skb,
+                             struct virtio_nic_tx_slot *slot)
+{
+    memset(&slot->hdr, 0, sizeof(slot->hdr));
+
+    return virtio_net_hdr_from_skb(skb, &slot->hdr.hdr,
+                                   virtio_is_little_endian(priv->vdev), false, 0);
+}
+
 netdev_tx_t virtio_nic_start_xmit(struct sk_buff *skb, struct net_device *ndev)
 {
     struct virtio_nic_priv *priv = netdev_priv(ndev);
-    struct virtio_nic_queue *q;
-    struct scatterlist sg[16];
-    int nents, err;
+    u16 qidx = skb_get_queue_mapping(skb);
+    struct virtio_nic_queue *q = &priv->queues[qidx];
+    struct netdev_queue *txq = netdev_get_tx_queue(ndev, qidx);
+    struct virtio_nic_tx_slot *slot;
+    unsigned int len = skb->len;  /* skb may be reclaimed once queued */
+    bool more = netdev_xmit_more();
+    bool csum_offload;
+    bool copied = false;
+    int err;
     ktime_t start_time;
-    u32 flow_id;
+    bool kick;
 
     start_time = ktime_get();
-    
-    /* Extract flow ID for QoS and failover */
-    flow_id = skb->hash ? skb->hash % priv->num_queues : 0;
-    q = &priv->queues[flow_id % priv->active_queues];
 
-    if (enable_zero_copy) {
-        /* Zero-copy DMA mapping */
-        err = virtio_nic_dma_map_skb(skb, sg, &nents);
-        if (err) {
-            dev_kfree_skb_any(skb);
-            return NETDEV_TX_BUSY;
-        }
+    /* The slot holds the skb until TX completion */
+    slot = virtio_nic_tx_slot_get(q);
+    if (!slot) {
+        netif_tx_stop_queue(txq);
+        q->tx_stops++;
+        return NETDEV_TX_BUSY;
+    }
+    slot->skb = skb;
+
+    /* Checksum and segmentation requests travel in the header */
+    if (unlikely(virtio_nic_tx_hdr(priv, skb, slot)))
+        goto drop;
+    csum_offload = slot->hdr.hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    sg_init_one(&slot->sg[0], &slot->hdr, priv->hdr_len);
+    sg_unmark_end(&slot->sg[0]);
+
+    if (len <= q->tx_copybreak) {
+        /*
+         * Copy-break: one linear slab entry instead of walking the skb's
+         * frags.  Behind an IOMMU the virtio core still maps it per add.
+         */
+        void *buf = virtio_nic_tx_copy_buf(q, slot);
+
+        skb_copy_bits(skb, 0, buf, len);
+        sg_init_one(&slot->sg[1], buf, len);
+        slot->nents = 1;
+        slot->len = len;
+        slot->copied = copied = true;
     } else {
-        /* Traditional scatter-gather */
-        sg_init_table(sg, 1);
-        sg_set_buf(sg, skb->data, skb->len);
-        nents = 1;
+        /*
+         * Zero-copy: the device reads the skb's own pages.  The virtio core
+         * maps them as it adds the buffer, so no mapping of our own.
+         */
+        sg_init_table(&slot->sg[1], skb_shinfo(skb)->nr_frags + 1);
+        err = skb_to_sgvec(skb, &slot->sg[1], 0, skb->len);
+        if (unlikely(err < 0))
+            goto drop;
+        slot->nents = err;
     }
 
-    err = virtio_nic_enqueue(q, sg, 1, 0, skb);
-    if (err) {
-        dev_kfree_skb_any(skb);
-        return NETDEV_TX_BUSY;
+    err = virtio_nic_enqueue(q, slot->sg, 1, 0, slot, false);
+    if (err)
+        goto drop;
+
+    /* The device reads the copy, so the skb can go now; the slot is no longer ours */
+    if (copied)
+        dev_consume_skb_any(skb);
+
+    /* Stop this subqueue before its ring is full; TX completion wakes it */
+    if (!virtio_nic_tx_has_room(q)) {
+        netif_tx_stop_queue(txq);
+        q->tx_stops++;
+        smp_mb();
+        if (unlikely(virtio_nic_tx_has_room(q)))
+            netif_tx_start_queue(txq);
     }
 
+    /*
+     * Defer the doorbell while the stack has more packets for us, but
+     * bound the burst so the device is not left idle behind a long train.
+     * BQL reports whether it stopped the queue, in which case no further
+     * xmit will come to flush us and we must kick now.
+     */
+    kick = __netdev_tx_sent_queue(txq, len, more) || netif_xmit_stopped(txq) ||
+           tx_kick_batch <= 0 || READ_ONCE(q->tx_unkicked) >= tx_kick_batch;
+    if (kick)
+        virtio_nic_tx_kick(q);
+
     /* Update statistics */
-    spin_lock(&priv->stats_lock);
-    priv->total_tx_packets++;
-    priv->total_tx_bytes += skb->len;
-    q->tx_packets++;
-    q->tx_bytes += skb->len;
-    spin_unlock(&priv->stats_lock);
+    u64_stats_update_begin(&q->tx_stats.syncp);
+    u64_stats_inc(&q->tx_stats.packets);
+    u64_stats_add(&q->tx_stats.bytes, len);
+    if (csum_offload)
+        u64_stats_inc(&q->tx_stats.csum_offload);
+    else
+        u64_stats_inc(&q->tx_stats.csum_sw);
+    if (copied)
+        u64_stats_inc(&q->tx_stats.copybreak);
+    u64_stats_update_end(&q->tx_stats.syncp);
 
     /* Record latency for telemetry */
     telemetry_record_latency(ktime_to_ns(ktime_sub(ktime_get(), start_time)));
     telemetry_record_tx();
 
     return NETDEV_TX_OK;
+
+drop:
+    virtio_nic_tx_slot_put(q, slot);
+    u64_stats_update_begin(&q->tx_stats.syncp);
+    u64_stats_inc(&q->tx_stats.dropped);
+    u64_stats_update_end(&q->tx_stats.syncp);
+    dev_kfree_skb_any(skb);
+
+    /* Don't leave earlier xmit_more packets stranded behind the drop */
+    if (!more)
+        virtio_nic_tx_kick(q);
+    return NETDEV_TX_OK;
+}
+
+/* The watchdog saw a stopped subqueue make no progress: reset its pair */
+void virtio_nic_tx_timeout(struct net_device *ndev, unsigned int txqueue)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    struct virtio_nic_queue *q = &priv->queues[txqueue];
+
+    netdev_warn(ndev, "TX queue %u timed out (%u in flight), resetting it\n",
+                txqueue, virtqueue_get_vring_size(q->tx_vq) - q->tx_vq->num_free);
+    virtio_nic_queue_mark_failed(priv, txqueue);
+    schedule_work(&q->failover_work);
 }
 
 /* NAPI poll function for efficient packet processing */
 int virtio_nic_poll(struct napi_struct *napi, int budget)
 {
     struct virtio_nic_queue *q = container_of(napi, struct virtio_nic_queue, napi);
-    struct virtio_nic_priv *priv = netdev_priv(q->vq->vdev->priv);
-    unsigned int len;
-    void *buf;
-    int work_done = 0;
-
-    while (work_done < budget) {
-        buf = virtio_nic_dequeue(q, &len);
-        if (!buf)
-            break;
-
-        /* Process received packet */
-        if (len > 0) {
-            struct sk_buff *skb = (struct sk_buff *)buf;
-            netif_receive_skb(skb);
-            work_done++;
-            
-            /* Update statistics */
-            spin_lock(&priv->stats_lock);
-            priv->total_rx_packets++;
-            priv->total_rx_bytes += len;
-            q->rx_packets++;
-            q->rx_bytes += len;
-            spin_unlock(&priv->stats_lock);
-            
-            telemetry_record_rx();
+    bool xsk_busy = false;
+    unsigned int opaque;
+    bool tx_pending;
+    int work_done;
+    int tx_done;
+
+    /* Reclaim finished TX first so the stack can refill the ring */
+    tx_done = virtio_nic_tx_reclaim(q, budget);
+
+    /* AF_XDP zero-copy: drain the socket's TX ring onto the same virtqueue */
+    if (q->xsk_pool)
+        xsk_busy = !virtio_nic_xsk_xmit(q, budget);
+
+    /* Receive into page_pool buffers and refill the ring below the watermark */
+    work_done = virtio_nic_rx_poll(q, budget);
+
+    /* More TX completions or XSK descriptors pending: stay scheduled */
+    if (tx_done >= budget || xsk_busy)
+        return budget;
+
+    if (work_done >= budget)
+        return budget;
+
+    /*
+     * Report the real work done so gro_flush_timeout and
+     * napi_defer_hard_irqs can keep us polling instead of re-arming.
+     * RX is armed before completing so virtqueue_poll() catches a buffer
+     * that lands in between without waiting for another interrupt.  With
+     * EVENT_IDX, TX only interrupts once most in-flight packets are done.
+     */
+    opaque = virtqueue_enable_cb_prepare(q->rx_vq);
+    if (napi_complete_done(napi, work_done)) {
+        tx_pending = !virtqueue_enable_cb_delayed(q->tx_vq);
+        if (unlikely(virtqueue_poll(q->rx_vq, opaque) || tx_pending) &&
+            napi_schedule_prep(napi)) {
+            virtqueue_disable_cb(q->rx_vq);
+            virtqueue_disable_cb(q->tx_vq);
+            __napi_schedule(napi);
         }
-    }
-
-    if (work_done < budget) {
-        napi_complete(napi);
-        virtqueue_enable_cb(q->vq);
+    } else {
+        virtqueue_disable_cb(q->rx_vq);
     }
 
     return work_done;
 }
 
-/* Enhanced statistics collection */
-struct net_device_stats *virtio_nic_get_stats(struct net_device *ndev)
+/* Aggregate per-queue counters; lockless against the data path */
+void virtio_nic_get_stats64(struct net_device *ndev, struct rtnl_link_stats64 *stats)
 {
     struct virtio_nic_priv *priv = netdev_priv(ndev);
-    struct net_device_stats *stats = &ndev->stats;
+    struct virtio_nic_queue_stats qs;
     int i;
 
-    spin_lock(&priv->stats_lock);
-    stats->rx_packets = priv->total_rx_packets;
-    stats->tx_packets = priv->total_tx_packets;
-    stats->rx_bytes = priv->total_rx_bytes;
-    stats->tx_bytes = priv->total_tx_bytes;
-    
     for (i = 0; i < priv->num_queues; i++) {
-        stats->rx_errors += priv->queues[i].rx_errors;
-        stats->tx_errors += priv->queues[i].tx_errors;
-        stats->rx_dropped += priv->queues[i].rx_dropped;
-        stats->tx_dropped += priv->queues[i].tx_dropped;
+        virtio_nic_get_queue_stats(&priv->queues[i], &qs);
+
+        stats->rx_packets += qs.rx_packets;
+        stats->tx_packets += qs.tx_packets;
+        stats->rx_bytes += qs.rx_bytes;
+        stats->tx_bytes += qs.tx_bytes;
+        stats->rx_errors += qs.rx_errors;
+        stats->tx_errors += qs.tx_errors;
+        stats->rx_dropped += qs.rx_dropped;
+        stats->tx_dropped += qs.tx_dropped;
     }
-    spin_unlock(&priv->stats_lock);
-
-    return stats;
 }
 
+/* Device features the driver negotiates */
+static unsigned int features[] = {
+    VIRTIO_NET_F_MRG_RXBUF,
+    VIRTIO_NET_F_CSUM,
+    VIRTIO_NET_F_GUEST_CSUM,
+    VIRTIO_NET_F_GUEST_TSO4,
+    VIRTIO_NET_F_GUEST_TSO6,
+    VIRTIO_NET_F_GUEST_ECN,
+    VIRTIO_NET_F_GUEST_USO4,
+    VIRTIO_NET_F_GUEST_USO6,
+    VIRTIO_NET_F_CTRL_GUEST_OFFLOADS,
+    VIRTIO_NET_F_HOST_TSO4,
+    VIRTIO_NET_F_HOST_TSO6,
+    VIRTIO_NET_F_HOST_ECN,
+    VIRTIO_NET_F_HOST_USO,
+    VIRTIO_NET_F_CTRL_VQ,
+    VIRTIO_NET_F_CTRL_RX,
+    VIRTIO_NET_F_NOTF_COAL,
+    VIRTIO_NET_F_VQ_NOTF_COAL,
+    VIRTIO_NET_F_MQ,
+    VIRTIO_NET_F_RSS,
+    VIRTIO_NET_F_HASH_REPORT,
+};
+
 static const struct virtio_device_id id_table[] = {
     { VIRTIO_ID_NET, VIRTIO_DEV_ANY_ID },
     { 0 }
 };
 MODULE_DEVICE_TABLE(virtio, id_table);
 
+/* Drop feature combinations the driver cannot receive with */
+static int virtio_nic_validate(struct virtio_device *vdev)
+{
+    /*
+     * The virtio core keeps VIRTIO_F_RING_PACKED, EVENT_IDX, INDIRECT_DESC
+     * and (where the ring supports it) IN_ORDER as transport features, used
+     * whenever offered; clearing them here is the only way back to the old
+     * behaviour for comparison.
+     */
+    if (!enable_packed_ring)
+        __virtio_clear_bit(vdev, VIRTIO_F_RING_PACKED);
+    if (!enable_event_idx)
+        __virtio_clear_bit(vdev, VIRTIO_RING_F_EVENT_IDX);
+    if (!enable_in_order)
+        __virtio_clear_bit(vdev, VIRTIO_F_IN_ORDER);
+    if (!enable_indirect_desc)
+        __virtio_clear_bit(vdev, VIRTIO_RING_F_INDIRECT_DESC);
+
+    /* Coalesced segments span pages: they need mergeable buffers and a checksum */
+    if (!virtio_has_feature(vdev, VIRTIO_NET_F_MRG_RXBUF) ||
+        !virtio_has_feature(vdev, VIRTIO_NET_F_GUEST_CSUM)) {
+        __virtio_clear_bit(vdev, VIRTIO_NET_F_GUEST_TSO4);
+        __virtio_clear_bit(vdev, VIRTIO_NET_F_GUEST_TSO6);
+        __virtio_clear_bit(vdev, VIRTIO_NET_F_GUEST_ECN);
+        __virtio_clear_bit(vdev, VIRTIO_NET_F_GUEST_USO4);
+        __virtio_clear_bit(vdev, VIRTIO_NET_F_GUEST_USO6);
+    }
+
+    return 0;
+}
+
 static struct virtio_driver virtio_nic_driver = {
     .driver.name = "virtio_nic",
     .driver.owner = THIS_MODULE,
+    .feature_table = features,
+    .feature_table_size = ARRAY_SIZE(features),
     .id_table = id_table,
+    .validate = virtio_nic_validate,
     .probe = virtio_nic_probe,
     .remove = virtio_nic_remove,
 };
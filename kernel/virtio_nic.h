@@ -3,6 +3,7 @@
 
 #include <linux/netdevice.h>
 #include <linux/virtio.h>
+#include <linux/virtio_config.h>
 #include <linux/virtio_net.h>
 #include <linux/pci.h>
 #include <linux/numa.h>
@@ -11,12 +12,47 @@
 #include <linux/workqueue.h>
 #include <linux/atomic.h>
 #include <linux/perf_event.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/average.h>
+#include <linux/if_vlan.h>
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+#include <net/xdp.h>
 
 /* Performance tuning constants */
 #define VIRTIO_NIC_MAX_QUEUES 32
 #define VIRTIO_NIC_DMA_CHUNK_SIZE (64 * 1024)  /* 64KB DMA chunks */
 #define VIRTIO_NIC_COALESCE_USECS 64
 #define VIRTIO_NIC_NAPI_WEIGHT 64
+#define VIRTIO_NIC_TX_KICK_BATCH 64  /* max packets queued per doorbell */
+#define VIRTIO_NIC_TX_MAX_SG (MAX_SKB_FRAGS + 2)  /* virtio_net_hdr + linear part + frags */
+#define VIRTIO_NIC_TX_RECLAIM_BATCH 32
+#define VIRTIO_NIC_TX_COPYBREAK_MAX 512  /* largest packet copied into the slab */
+#define VIRTIO_NIC_RX_HEADROOM XDP_PACKET_HEADROOM  /* room for XDP to grow the head */
+#define VIRTIO_NIC_RX_REFILL_BATCH 64  /* refill once this many slots drain */
+#define VIRTIO_NIC_RX_COPYBREAK 256    /* default ETHTOOL_RX_COPYBREAK */
+#define VIRTIO_NIC_GOOD_PACKET_LEN (ETH_HLEN + VLAN_HLEN + ETH_DATA_LEN)
+#define VIRTIO_NIC_RX_SHINFO_SIZE SKB_DATA_ALIGN(sizeof(struct skb_shared_info))
+/* Largest mergeable buffer that still fits one page with headroom and shinfo */
+#define VIRTIO_NIC_MRG_MAX_BUF_LEN \
+    (PAGE_SIZE - SKB_DATA_ALIGN(VIRTIO_NIC_RX_HEADROOM) - VIRTIO_NIC_RX_SHINFO_SIZE)
+#define VIRTIO_NIC_RECOVERY_WINDOW_MS 5000  /* failed queue retried after this long */
+#define VIRTIO_NIC_RSS_MAX_TABLE 128  /* indirection table entries */
+#define VIRTIO_NIC_RSS_MAX_KEY 40     /* Toeplitz key bytes */
+#define VIRTIO_NIC_RSS_HASH_TYPES \
+    (VIRTIO_NET_RSS_HASH_TYPE_IPv4 | VIRTIO_NET_RSS_HASH_TYPE_TCPv4 | \
+     VIRTIO_NET_RSS_HASH_TYPE_UDPv4 | VIRTIO_NET_RSS_HASH_TYPE_IPv6 | \
+     VIRTIO_NET_RSS_HASH_TYPE_TCPv6 | VIRTIO_NET_RSS_HASH_TYPE_UDPv6)
+/* Guest offloads that make the device hand us coalesced segments */
+#define VIRTIO_NIC_GUEST_GSO_OFFLOADS \
+    (BIT_ULL(VIRTIO_NET_F_GUEST_TSO4) | BIT_ULL(VIRTIO_NET_F_GUEST_TSO6) | \
+     BIT_ULL(VIRTIO_NET_F_GUEST_ECN) | BIT_ULL(VIRTIO_NET_F_GUEST_USO4) | \
+     BIT_ULL(VIRTIO_NET_F_GUEST_USO6))
+
+/* Moving average of received packet length, used to size mergeable buffers */
+DECLARE_EWMA(pkt_len, 0, 64)
+
+struct virtio_nic_priv;
 
 /* Flow tracking for QoS and failover */
 struct virtio_nic_flow {
@@ -28,9 +64,155 @@ struct virtio_nic_flow {
     struct list_head list;
 };
 
+/* Flows pinned away from their home queue; direct-mapped, newest entry wins */
+#define VIRTIO_NIC_FLOW_OVERRIDES 256
+
+struct virtio_nic_flow_override {
+    u32 flow_id;
+    u16 from;       /* queue the flow was moved off */
+    u16 to;
+    bool valid;
+};
+
+/*
+ * TX steering read by ndo_select_queue under RCU.  Writers copy, modify
+ * and publish under tx_steer_lock; while nothing is failed or overridden
+ * the pointer is NULL and queue selection is the stack's default.
+ */
+struct virtio_nic_tx_steer {
+    struct rcu_head rcu;
+    DECLARE_BITMAP(failed, VIRTIO_NIC_MAX_QUEUES);
+    int redirect[VIRTIO_NIC_MAX_QUEUES];    /* for failed queues; -1: next healthy */
+    unsigned int nr_overrides;
+    struct virtio_nic_flow_override flows[VIRTIO_NIC_FLOW_OVERRIDES];
+};
+
+/* In-flight TX packet: owns the skb until the device completes it */
+struct virtio_nic_tx_slot {
+    struct sk_buff *skb;
+    struct virtio_net_hdr_v1_hash hdr;  /* offload request, sent as sg[0] */
+    struct scatterlist sg[VIRTIO_NIC_TX_MAX_SG];
+    int nents;      /* packet data entries, starting at sg[1] */
+    bool xsk;       /* AF_XDP frame: completion goes to the socket, not BQL */
+    bool copied;    /* data lives in the queue's copy slab; skb already freed */
+    unsigned int len;   /* bytes of a copied packet, for BQL on completion */
+};
+
+/*
+ * Hot-path counters.  RX is only written from NAPI and TX only under the
+ * subqueue's xmit lock, so each side has its own writer and syncp and
+ * readers never block either path.
+ */
+struct virtio_nic_rq_stats {
+    struct u64_stats_sync syncp;
+    u64_stats_t packets;
+    u64_stats_t bytes;
+    u64_stats_t dropped;
+    u64_stats_t alloc_failed;
+    u64_stats_t hashed;         /* delivered with a device RSS hash */
+    u64_stats_t csum_offload;   /* checksum validated or left partial by the device */
+    u64_stats_t csum_sw;        /* left for the stack to verify */
+    u64_stats_t copybreak;      /* copied out, buffer reposted to the ring */
+    u64_stats_t xdp_packets;
+    u64_stats_t xdp_drops;
+    u64_stats_t xdp_tx;
+    u64_stats_t xdp_redirects;
+};
+
+struct virtio_nic_sq_stats {
+    struct u64_stats_sync syncp;
+    u64_stats_t packets;
+    u64_stats_t bytes;
+    u64_stats_t dropped;
+    u64_stats_t csum_offload;   /* device fills in the checksum */
+    u64_stats_t csum_sw;        /* checksum already complete (or none needed) */
+    u64_stats_t copybreak;      /* copied into the slab, not sent from the skb */
+};
+
+/* Control virtqueue command header and ack; kmalloc'd so it is DMA-safe */
+struct virtio_nic_ctrl_buf {
+    struct virtio_net_ctrl_hdr hdr;
+    virtio_net_ctrl_ack status;
+    struct virtio_net_ctrl_mq mq;
+    __virtio64 offloads;
+};
+
+/*
+ * One queued control command.  The header, ack and any copied payload
+ * share a kmalloc'd buffer the device can DMA; @complete runs once the
+ * device has answered, possibly from the ctrl vq interrupt.
+ */
+struct virtio_nic_ctrl_req {
+    struct virtio_net_ctrl_hdr hdr;
+    virtio_net_ctrl_ack status;
+    struct scatterlist *out;        /* caller-owned payload, else data[] */
+    struct scatterlist data_sg;
+    void (*complete)(struct virtio_nic_priv *priv, struct virtio_nic_ctrl_req *req, bool ok);
+    void *ctx;
+    u8 data[];
+};
+
+/* Commands queued together, waited for together */
+struct virtio_nic_ctrl_batch {
+    atomic_t pending;
+    atomic_t failed;
+};
+
+/*
+ * VIRTIO_NET_CTRL_MQ_RSS_CONFIG payload.  The wire format has a variable
+ * length table, so it is sent as four sg entries pointing into this.
+ */
+struct virtio_nic_rss_cfg {
+    __le32 hash_types;
+    __le16 indirection_table_mask;
+    __le16 unclassified_queue;
+    __le16 indirection_table[VIRTIO_NIC_RSS_MAX_TABLE];
+    __le16 max_tx_vq;
+    u8 hash_key_length;
+    u8 key[VIRTIO_NIC_RSS_MAX_KEY];
+};
+
+/* Snapshot of one queue's counters */
+struct virtio_nic_queue_stats {
+    u64 rx_bytes;
+    u64 tx_bytes;
+    u64 rx_packets;
+    u64 tx_packets;
+    u64 rx_errors;
+    u64 tx_errors;
+    u64 rx_dropped;
+    u64 tx_dropped;
+    u64 rx_hashed;
+    u64 rx_csum_offload;
+    u64 rx_csum_sw;
+    u64 rx_copybreak;
+    u64 tx_csum_offload;
+    u64 tx_csum_sw;
+    u64 tx_copybreak;
+    u64 xdp_packets;
+    u64 xdp_drops;
+    u64 xdp_tx;
+    u64 xdp_redirects;
+    int pending_packets;
+    int numa_node;
+    int cpu_id;
+};
+
+/* Memory one queue pair holds, by what it is spent on */
+struct virtio_nic_queue_mem {
+    u64 rx_vring_bytes;
+    u64 tx_vring_bytes;
+    u64 rx_buf_bytes;       /* RX buffers posted to a full ring */
+    u64 tx_slot_bytes;      /* TX slot tables and copy slab */
+};
+
 /* Enhanced queue structure with NUMA awareness */
 struct virtio_nic_queue {
-    struct virtqueue *vq;
+    struct virtio_nic_priv *priv;
+    struct virtqueue *rx_vq;
+    struct virtqueue *tx_vq;
+    char rx_name[16];
+    char tx_name[16];
     struct napi_struct napi;
     spinlock_t lock;
     u32 flow_tag;
@@ -42,17 +224,76 @@ struct virtio_nic_queue {
     struct work_struct failover_work;
     struct list_head flow_list;
     spinlock_t flow_lock;
-    u64 rx_bytes;
-    u64 tx_bytes;
-    u64 rx_packets;
-    u64 tx_packets;
+    struct virtio_nic_rq_stats rx_stats ____cacheline_aligned_in_smp;
+    struct virtio_nic_sq_stats tx_stats ____cacheline_aligned_in_smp;
+    /* Error counts are cold; the health check reads and resets them */
     u64 rx_errors;
     u64 tx_errors;
-    u64 rx_dropped;
-    u64 tx_dropped;
+    /* Doorbell batching: packets added since the last kick */
+    unsigned int tx_unkicked;
+    u64 tx_kicks;
+    u64 tx_kick_packets;
+    /* Ring use: descriptors consumed and how often the subqueue filled up */
+    u64 tx_descs;
+    u64 tx_stops;
+    unsigned int tx_desc_reserve;   /* free descriptors a worst-case skb needs */
+    /* Interrupts taken, one writer each (the vq callback) */
+    u64 rx_irqs;
+    u64 tx_irqs;
+    /* Per-queue ring resets (failover_work), timed from quiesce to resume */
+    u64 resets;
+    u64 reset_failed;
+    u64 reset_ns;               /* last successful reset */
+    u64 reset_ns_max;
+    atomic_long_t tx_steered;   /* packets sent elsewhere while this queue was failed */
+    /* TX completion: one slot per ring entry, free slots kept on a stack */
+    struct virtio_nic_tx_slot *tx_slots;
+    u16 *tx_free;
+    unsigned int tx_free_top;
+    unsigned int tx_ring_size;
+    u64 tx_completed;
+    u64 tx_reclaim_ns;
+    /* VIRTIO_F_IN_ORDER: slots are handed out round-robin and retire as runs */
+    bool tx_in_order;
+    unsigned int tx_head;       /* next slot to hand out */
+    unsigned int tx_inflight;
+    /* TX copy-break: one slab buffer per slot for packets up to tx_copybreak */
+    u8 *tx_copy_slab;
+    unsigned int tx_copybreak;
+    /* RX refill: page_pool fragments posted to the RX ring */
+    struct page_pool *page_pool;
+    unsigned int rx_ring_size;
+    unsigned int rx_buf_len;
+    unsigned int rx_truesize;
+    bool rx_premapped;
+    struct ewma_pkt_len mrg_avg_pkt_len;
+    /* XDP: program run on each RX buffer before an skb is built */
+    struct bpf_prog __rcu *xdp_prog;
+    struct xdp_rxq_info xdp_rxq;
+    /* AF_XDP zero-copy: UMEM frames replace page_pool buffers on this queue */
+    struct xsk_buff_pool *xsk_pool;
+    struct xdp_rxq_info xsk_rxq;
+    struct virtio_net_hdr_v1_hash xsk_hdr;  /* zeroed header for XSK TX */
+    struct xdp_desc xsk_tx_desc;            /* frame the TX ring refused, sent next */
+    bool xsk_tx_held;                       /* xsk_tx_desc is valid */
+    /* Packets per RSS indirection bucket (NAPI-only writer), may be NULL */
+    u64 *rss_bucket_hits;
     struct perf_event *perf_event;
 };
 
+/*
+ * Dedicated XDP transmit ring.  Each CPU maps to one of these, so XDP_TX
+ * and ndo_xdp_xmit never contend with the stack's TX queues; the lock only
+ * matters when there are fewer rings than CPUs.
+ */
+struct virtio_nic_xdp_sq {
+    struct virtio_nic_priv *priv;
+    struct virtqueue *vq;
+    char name[16];
+    spinlock_t lock;
+    unsigned int unkicked;
+} ____cacheline_aligned_in_smp;
+
 /* Zero-copy DMA buffer management */
 struct virtio_nic_dma_buf {
     struct page **pages;
@@ -69,18 +310,70 @@ struct virtio_nic_priv {
     struct virtio_device *vdev;
     struct net_device *netdev;
     struct virtio_nic_queue *queues;
-    unsigned int num_queues;
+    unsigned int num_queues;            /* pairs created at load: the ethtool -L maximum */
     unsigned int active_queues;
+    u64 channel_changes;                /* successful ethtool -L changes */
+    u64 channel_change_ns;              /* how long the last one took */
     int numa_node;
     struct cpumask cpu_mask;
     struct workqueue_struct *failover_wq;
     struct timer_list health_check_timer;
     atomic_t failover_count;
-    u64 total_rx_bytes;
-    u64 total_tx_bytes;
-    u64 total_rx_packets;
-    u64 total_tx_packets;
-    spinlock_t stats_lock;
+    struct virtio_nic_failover_state *failover_state;
+    struct virtio_nic_tx_steer __rcu *tx_steer;
+    spinlock_t tx_steer_lock;
+    unsigned int hdr_len;               /* virtio_net_hdr size on the wire */
+    bool mergeable_rx_bufs;             /* VIRTIO_NET_F_MRG_RXBUF negotiated */
+    unsigned int rx_copybreak;          /* copy RX frames up to this size (ethtool tunable) */
+    struct delayed_work refill_work;    /* RX refill after GFP_ATOMIC failure */
+    struct virtio_nic_xdp_sq *xdp_sqs;  /* per-CPU XDP TX rings, may be none */
+    unsigned int num_xdp_sqs;
+    bool xdp_enabled;
+    /*
+     * Control virtqueue: ctrl_vq_lock guards the ring itself, ctrl_lock the
+     * shared ctrl buffers used by synchronous commands.
+     */
+    struct virtqueue *ctrl_vq;
+    struct virtio_nic_ctrl_buf *ctrl;
+    struct mutex ctrl_lock;
+    spinlock_t ctrl_vq_lock;
+    u64 ctrl_cmds;
+    u64 ctrl_kicks;
+    u64 ctrl_failed;
+    unsigned int ctrl_inflight;
+    bool has_cvq;
+    bool has_ctrl_rx;                   /* promisc/allmulti and MAC filter tables */
+    /* Device notification coalescing, as last set through ethtool -C */
+    bool has_notf_coal;
+    bool has_vq_notf_coal;              /* per-virtqueue rather than device-wide */
+    u32 coal_rx_usecs;
+    u32 coal_rx_frames;
+    u32 coal_tx_usecs;
+    u32 coal_tx_frames;
+    bool has_mq;
+    unsigned int max_queue_pairs;       /* pairs the device exposes */
+    /* Guest offloads: negotiated set, and whether rx-gro-hw can toggle it */
+    u64 guest_offloads;
+    bool has_offloads_ctrl;
+    /* RSS: driver copy of what was last programmed into the device */
+    bool has_rss;
+    bool has_hash_report;               /* RX headers carry the device hash */
+    u16 rss_table_size;
+    u8 rss_key_size;
+    u32 rss_hash_types;
+    u32 rss_indir[VIRTIO_NIC_RSS_MAX_TABLE];
+    u8 rss_key[VIRTIO_NIC_RSS_MAX_KEY];
+    struct virtio_nic_rss_cfg *rss_cfg;
+};
+
+/* Failover counters, as reported by virtio_nic_get_failover_stats() */
+struct virtio_nic_failover_stats {
+    int failover_count;
+    int active_queues;
+    int failed_queues;
+    int total_failures;         /* queues currently on the failed list */
+    int max_failure_count;      /* most failures recorded for one of them */
+    bool enabled;
 };
 
 /* Telemetry and monitoring */
@@ -98,37 +391,237 @@ struct virtio_nic_telemetry {
     spinlock_t lock;
 };
 
+/*
+ * Mergeable RX buffer size for a given average packet length: at least a
+ * full Ethernet frame, at most what fits in one page fragment, rounded to a
+ * cache line so consecutive fragments don't share one.
+ */
+static inline unsigned int virtio_nic_mrg_buf_len(unsigned long avg_pkt_len,
+                                                  unsigned int hdr_len)
+{
+    unsigned int len;
+
+    len = hdr_len + clamp_t(unsigned int, avg_pkt_len,
+                            VIRTIO_NIC_GOOD_PACKET_LEN,
+                            VIRTIO_NIC_MRG_MAX_BUF_LEN - hdr_len);
+
+    return min_t(unsigned int, ALIGN(len, L1_CACHE_BYTES),
+                 VIRTIO_NIC_MRG_MAX_BUF_LEN);
+}
+
+/* skb hash type implied by a VIRTIO_NET_HASH_REPORT_* value */
+static inline enum pkt_hash_types virtio_nic_hash_type(u16 report)
+{
+    switch (report) {
+    case VIRTIO_NET_HASH_REPORT_TCPv4:
+    case VIRTIO_NET_HASH_REPORT_UDPv4:
+    case VIRTIO_NET_HASH_REPORT_TCPv6:
+    case VIRTIO_NET_HASH_REPORT_UDPv6:
+    case VIRTIO_NET_HASH_REPORT_TCPv6_EX:
+    case VIRTIO_NET_HASH_REPORT_UDPv6_EX:
+        return PKT_HASH_TYPE_L4;
+    case VIRTIO_NET_HASH_REPORT_IPv4:
+    case VIRTIO_NET_HASH_REPORT_IPv6:
+    case VIRTIO_NET_HASH_REPORT_IPv6_EX:
+        return PKT_HASH_TYPE_L3;
+    default:
+        return PKT_HASH_TYPE_NONE;
+    }
+}
+
+/*
+ * Read the device hash from an RX header.  Returns the report type, or
+ * VIRTIO_NET_HASH_REPORT_NONE when hash reporting is off or disabled via
+ * ethtool -K rxhash.
+ */
+static inline u16 virtio_nic_hdr_hash(struct virtio_nic_priv *priv, const void *hdr,
+                                      u32 *value)
+{
+    const struct virtio_net_hdr_v1_hash *h = hdr;
+
+    if (!priv->has_hash_report || !(priv->netdev->features & NETIF_F_RXHASH))
+        return VIRTIO_NET_HASH_REPORT_NONE;
+
+    *value = le32_to_cpu(h->hash_value);
+    return le16_to_cpu(h->hash_report);
+}
+
+static inline void virtio_nic_skb_set_hash(struct sk_buff *skb, u32 value, u16 report)
+{
+    enum pkt_hash_types type = virtio_nic_hash_type(report);
+
+    if (type != PKT_HASH_TYPE_NONE)
+        skb_set_hash(skb, value, type);
+}
+
+/*
+ * Apply the device's checksum verdict from an RX header.  @moved is how far
+ * an XDP program shifted the packet start since the header was written.
+ * A partial checksum must be honoured even with rxcsum off, since the
+ * packet carries no valid checksum yet.  Returns false if csum_start is
+ * outside the packet.
+ */
+static inline bool virtio_nic_skb_set_csum(struct virtio_nic_priv *priv, struct sk_buff *skb,
+                                           const struct virtio_net_hdr *hdr, int moved)
+{
+    int start;
+
+    if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        start = virtio16_to_cpu(priv->vdev, hdr->csum_start) - moved;
+        return start >= 0 &&
+               skb_partial_csum_set(skb, start,
+                                    virtio16_to_cpu(priv->vdev, hdr->csum_offset));
+    }
+
+    if ((hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID) &&
+        (priv->netdev->features & NETIF_F_RXCSUM))
+        skb->ip_summed = CHECKSUM_UNNECESSARY;
+
+    return true;
+}
+
+/* Netdev TX subqueue backing a driver queue (queue i <-> subqueue i) */
+static inline struct netdev_queue *virtio_nic_txq(struct virtio_nic_queue *q)
+{
+    return netdev_get_tx_queue(q->priv->netdev, q - q->priv->queues);
+}
+
+/*
+ * Queue pairs the device must enable for @pairs data pairs.  The XDP TX
+ * rings sit after every data pair, so they only get a device queue when
+ * all of those are enabled; RX stays on the data pairs either way (RSS
+ * indirects there, automatic steering follows the stack's TX queue).
+ */
+static inline u16 virtio_nic_device_pairs(struct virtio_nic_priv *priv, u16 pairs)
+{
+    return priv->num_xdp_sqs ? priv->num_queues + priv->num_xdp_sqs : pairs;
+}
+
+/* A slot's copy-break buffer; slots map 1:1 onto the slab */
+static inline void *virtio_nic_tx_copy_buf(struct virtio_nic_queue *q,
+                                           struct virtio_nic_tx_slot *slot)
+{
+    return q->tx_copy_slab + (slot - q->tx_slots) * q->tx_copybreak;
+}
+
 /* Function declarations */
 int virtio_nic_init(void);
 void virtio_nic_exit(void);
 int virtio_nic_open(struct net_device *ndev);
 int virtio_nic_stop(struct net_device *ndev);
+int virtio_nic_set_features(struct net_device *ndev, netdev_features_t features);
 netdev_tx_t virtio_nic_start_xmit(struct sk_buff *skb, struct net_device *ndev);
+void virtio_nic_tx_timeout(struct net_device *ndev, unsigned int txqueue);
+void virtio_nic_get_stats64(struct net_device *ndev, struct rtnl_link_stats64 *stats);
 
 /* Zero-copy DMA functions */
 int virtio_nic_dma_alloc_buffer(struct virtio_nic_dma_buf *buf, size_t size, bool write);
 void virtio_nic_dma_free_buffer(struct virtio_nic_dma_buf *buf);
-int virtio_nic_dma_map_skb(struct sk_buff *skb, struct scatterlist *sg, int *nents);
 
 /* Queue management with NUMA awareness */
 int virtio_nic_setup_queues(struct virtio_nic_priv *priv);
 void virtio_nic_teardown_queues(struct virtio_nic_priv *priv);
+int virtio_nic_set_active_queues(struct virtio_nic_priv *priv, unsigned int n);
+int virtio_nic_resize_rings(struct virtio_nic_priv *priv, u32 rx_size, u32 tx_size);
 int virtio_nic_enqueue(struct virtio_nic_queue *q, struct scatterlist *sg,
-                       unsigned int out, unsigned int in, void *data);
-void *virtio_nic_dequeue(struct virtio_nic_queue *q, unsigned int *len);
+                       unsigned int out, unsigned int in, void *data, bool kick);
+void *virtio_nic_dequeue(struct virtio_nic_queue *q, unsigned int *len, void **ctx);
+struct virtio_nic_tx_slot *virtio_nic_tx_slot_get(struct virtio_nic_queue *q);
+void virtio_nic_tx_slot_put(struct virtio_nic_queue *q, struct virtio_nic_tx_slot *slot);
+void virtio_nic_tx_kick(struct virtio_nic_queue *q);
+bool virtio_nic_tx_has_room(struct virtio_nic_queue *q);
+int virtio_nic_tx_reclaim(struct virtio_nic_queue *q, int budget);
+void virtio_nic_tx_recycle(struct virtqueue *vq, void *buf);
+int virtio_nic_poll(struct napi_struct *napi, int budget);
 int virtio_nic_assign_queue_to_cpu(struct virtio_nic_queue *q, int cpu);
+void virtio_nic_get_queue_stats(struct virtio_nic_queue *q, struct virtio_nic_queue_stats *stats);
+void virtio_nic_get_queue_mem(struct virtio_nic_queue *q, struct virtio_nic_queue_mem *mem);
+
+/* RX buffer refill */
+int virtio_nic_rx_init_queue(struct virtio_nic_queue *q);
+void virtio_nic_rx_cleanup_queue(struct virtio_nic_queue *q);
+bool virtio_nic_rx_refill(struct virtio_nic_queue *q, gfp_t gfp);
+void virtio_nic_rx_recycle(struct virtqueue *vq, void *buf);
+unsigned int virtio_nic_rx_mrg_len(struct virtio_nic_queue *q);
+void virtio_nic_rx_refill_work(struct work_struct *work);
+int virtio_nic_rx_poll(struct virtio_nic_queue *q, int budget);
+
+/* XDP */
+#define VIRTIO_NIC_XDP_TX     BIT(0)  /* frames queued on an XDP TX ring */
+#define VIRTIO_NIC_XDP_REDIR  BIT(1)  /* xdp_do_redirect() needs a flush */
+
+int virtio_nic_bpf(struct net_device *ndev, struct netdev_bpf *bpf);
+u32 virtio_nic_xdp_run(struct virtio_nic_queue *q, struct bpf_prog *prog,
+                       struct xdp_buff *xdp, unsigned int *xdp_xmit);
+void virtio_nic_xdp_flush(struct virtio_nic_priv *priv, unsigned int xdp_xmit);
+int virtio_nic_xdp_xmit(struct net_device *ndev, int n, struct xdp_frame **frames,
+                        u32 flags);
+void virtio_nic_xdp_free_unused(struct virtio_nic_xdp_sq *sq);
+
+/* AF_XDP zero-copy */
+int virtio_nic_xsk_pool_setup(struct net_device *ndev, struct xsk_buff_pool *pool, u16 qid);
+bool virtio_nic_xsk_refill(struct virtio_nic_queue *q, gfp_t gfp);
+int virtio_nic_xsk_rx_poll(struct virtio_nic_queue *q, int budget);
+bool virtio_nic_xsk_xmit(struct virtio_nic_queue *q, int budget);
+void virtio_nic_xsk_free_unused(struct virtio_nic_queue *q);
+int virtio_nic_xsk_wakeup(struct net_device *ndev, u32 qid, u32 flags);
+
+/* Control virtqueue */
+int virtio_nic_ctrl_init(struct virtio_nic_priv *priv);
+void virtio_nic_ctrl_cleanup(struct virtio_nic_priv *priv);
+void virtio_nic_ctrl_callback(struct virtqueue *vq);
+void virtio_nic_ctrl_free_unused(struct virtio_nic_priv *priv);
+struct virtio_nic_ctrl_req *virtio_nic_ctrl_req_alloc(u8 class, u8 cmd, const void *data,
+                                                      size_t len, gfp_t gfp);
+int virtio_nic_ctrl_submit(struct virtio_nic_priv *priv, struct virtio_nic_ctrl_req *req);
+void virtio_nic_ctrl_kick(struct virtio_nic_priv *priv);
+void virtio_nic_ctrl_batch_init(struct virtio_nic_ctrl_batch *batch);
+int virtio_nic_ctrl_batch_add(struct virtio_nic_priv *priv, struct virtio_nic_ctrl_batch *batch,
+                              u8 class, u8 cmd, const void *data, size_t len);
+int virtio_nic_ctrl_batch_run(struct virtio_nic_priv *priv, struct virtio_nic_ctrl_batch *batch);
+bool virtio_nic_ctrl_cmd(struct virtio_nic_priv *priv, u8 class, u8 cmd,
+                         struct scatterlist *out);
+void virtio_nic_set_rx_mode(struct net_device *ndev);
+int virtio_nic_set_notf_coal(struct virtio_nic_priv *priv, u32 rx_usecs, u32 rx_frames,
+                             u32 tx_usecs, u32 tx_frames);
+int virtio_nic_set_queue_pairs(struct virtio_nic_priv *priv, u16 pairs);
+int virtio_nic_set_guest_offloads(struct virtio_nic_priv *priv, u64 offloads);
+
+/* Receive Side Scaling */
+void virtio_nic_rss_probe(struct virtio_nic_priv *priv);
+int virtio_nic_rss_init(struct virtio_nic_priv *priv);
+void virtio_nic_rss_cleanup(struct virtio_nic_priv *priv);
+int virtio_nic_rss_commit(struct virtio_nic_priv *priv);
+void virtio_nic_rss_count(struct virtio_nic_queue *q, struct sk_buff *skb);
+void virtio_nic_set_ethtool_ops(struct net_device *ndev);
 
 /* MSI-X and interrupt management */
 int virtio_nic_request_irqs(struct virtio_nic_priv *priv);
 void virtio_nic_free_irqs(struct virtio_nic_priv *priv);
 void virtio_nic_update_coalesce(int usecs);
 int virtio_nic_setup_msix(struct virtio_nic_priv *priv);
+void virtio_nic_vq_callback(struct virtqueue *vq);
+void virtio_nic_set_affinity(struct virtio_nic_priv *priv);
 
 /* Failover and resilience */
 void virtio_nic_init_failover(struct virtio_nic_priv *priv);
+void virtio_nic_stop_failover(struct virtio_nic_priv *priv);
 void virtio_nic_cleanup_failover(struct virtio_nic_priv *priv);
 int virtio_nic_remap_queue(struct virtio_nic_priv *priv, int old_queue, int new_queue);
+int virtio_nic_find_available_queue(struct virtio_nic_priv *priv, int failed);
+void virtio_nic_reassign_queue_flows(struct virtio_nic_priv *priv, int old_queue, int new_queue);
+bool virtio_nic_queue_mark_failed(struct virtio_nic_priv *priv, int queue_id);
+void virtio_nic_queue_failed(struct virtio_nic_priv *priv, int queue_id);
+s64 virtio_nic_failover_recover(struct virtio_nic_priv *priv, ktime_t now);
+void virtio_nic_queue_recovered(struct virtio_nic_priv *priv, int queue_id);
+void virtio_nic_failover_work(struct work_struct *work);
+int virtio_nic_reset_queue(struct virtio_nic_queue *q);
+u16 virtio_nic_select_queue(struct net_device *ndev, struct sk_buff *skb,
+                            struct net_device *sb_dev);
+void virtio_nic_steer_queue_failed(struct virtio_nic_priv *priv, int queue_id, int target);
 void virtio_nic_flow_reassign(struct virtio_nic_priv *priv, u32 flow_id, int new_queue);
+void virtio_nic_get_failover_stats(struct virtio_nic_priv *priv,
+                                   struct virtio_nic_failover_stats *stats);
 
 /* Telemetry and monitoring */
 void telemetry_init(struct net_device *ndev);
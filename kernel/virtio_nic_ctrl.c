@@ -0,0 +1,485 @@
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
+#include <linux/virtio_config.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include "virtio_nic.h"
+
+/* Allocate the DMA-safe command buffers; the vq itself comes from setup_queues */
+int virtio_nic_ctrl_init(struct virtio_nic_priv *priv)
+{
+    mutex_init(&priv->ctrl_lock);
+    spin_lock_init(&priv->ctrl_vq_lock);
+
+    if (!priv->has_cvq)
+        return 0;
+
+    priv->ctrl = kzalloc(sizeof(*priv->ctrl), GFP_KERNEL);
+    if (!priv->ctrl)
+        return -ENOMEM;
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_init);
+
+void virtio_nic_ctrl_cleanup(struct virtio_nic_priv *priv)
+{
+    kfree(priv->ctrl);
+    priv->ctrl = NULL;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_cleanup);
+
+/* Take back every answered command and run its completion */
+static void virtio_nic_ctrl_reap(struct virtio_nic_priv *priv)
+{
+    struct virtio_nic_ctrl_req *req;
+    unsigned long flags;
+    unsigned int len;
+
+    for (;;) {
+        spin_lock_irqsave(&priv->ctrl_vq_lock, flags);
+        req = priv->ctrl_vq ? virtqueue_get_buf(priv->ctrl_vq, &len) : NULL;
+        if (req) {
+            priv->ctrl_inflight--;
+            if (req->status != VIRTIO_NET_OK)
+                priv->ctrl_failed++;
+        }
+        spin_unlock_irqrestore(&priv->ctrl_vq_lock, flags);
+
+        if (!req)
+            break;
+        req->complete(priv, req, req->status == VIRTIO_NET_OK);
+    }
+}
+
+/* ctrl vq interrupt: asynchronous commands complete here */
+void virtio_nic_ctrl_callback(struct virtqueue *vq)
+{
+    virtio_nic_ctrl_reap(vq->vdev->priv);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_callback);
+
+/*
+ * Free commands the device will never answer (device already reset).
+ * Their completions are not run: a waiter that gave up on a broken
+ * queue has already returned.
+ */
+void virtio_nic_ctrl_free_unused(struct virtio_nic_priv *priv)
+{
+    void *req;
+
+    if (!priv->ctrl_vq)
+        return;
+
+    while ((req = virtqueue_detach_unused_buf(priv->ctrl_vq)) != NULL)
+        kfree(req);
+    priv->ctrl_inflight = 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_free_unused);
+
+/* Build a command; a payload, if any, is copied into the request */
+struct virtio_nic_ctrl_req *virtio_nic_ctrl_req_alloc(u8 class, u8 cmd, const void *data,
+                                                      size_t len, gfp_t gfp)
+{
+    struct virtio_nic_ctrl_req *req;
+
+    req = kzalloc(struct_size(req, data, len), gfp);
+    if (!req)
+        return NULL;
+
+    req->hdr.class = class;
+    req->hdr.cmd = cmd;
+    req->status = ~0;
+    if (len) {
+        memcpy(req->data, data, len);
+        sg_init_one(&req->data_sg, req->data, len);
+        req->out = &req->data_sg;
+    }
+
+    return req;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_req_alloc);
+
+/*
+ * Post @req without notifying the device, so several commands can share
+ * one kick.  Returns -ENOSPC when the ring is full; @req stays the
+ * caller's on any error.
+ */
+int virtio_nic_ctrl_submit(struct virtio_nic_priv *priv, struct virtio_nic_ctrl_req *req)
+{
+    struct scatterlist hdr, stat, *sgs[3];
+    unsigned int out_num = 0;
+    unsigned long flags;
+    int err;
+
+    sg_init_one(&hdr, &req->hdr, sizeof(req->hdr));
+    sgs[out_num++] = &hdr;
+    if (req->out)
+        sgs[out_num++] = req->out;
+    sg_init_one(&stat, &req->status, sizeof(req->status));
+    sgs[out_num] = &stat;
+
+    spin_lock_irqsave(&priv->ctrl_vq_lock, flags);
+    if (!priv->ctrl_vq)
+        err = -ENODEV;
+    else
+        err = virtqueue_add_sgs(priv->ctrl_vq, sgs, out_num, 1, req, GFP_ATOMIC);
+    if (!err) {
+        priv->ctrl_inflight++;
+        priv->ctrl_cmds++;
+    }
+    spin_unlock_irqrestore(&priv->ctrl_vq_lock, flags);
+
+    return err;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_submit);
+
+/* Notify the device of everything submitted since the last kick */
+void virtio_nic_ctrl_kick(struct virtio_nic_priv *priv)
+{
+    unsigned long flags;
+    bool notify;
+
+    spin_lock_irqsave(&priv->ctrl_vq_lock, flags);
+    notify = priv->ctrl_vq && virtqueue_kick_prepare(priv->ctrl_vq);
+    if (notify)
+        priv->ctrl_kicks++;
+    spin_unlock_irqrestore(&priv->ctrl_vq_lock, flags);
+
+    if (notify)
+        virtqueue_notify(priv->ctrl_vq);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_kick);
+
+static void virtio_nic_ctrl_batch_done(struct virtio_nic_priv *priv,
+                                       struct virtio_nic_ctrl_req *req, bool ok)
+{
+    struct virtio_nic_ctrl_batch *batch = req->ctx;
+
+    if (!ok)
+        atomic_inc(&batch->failed);
+    kfree(req);
+    /* The waiter may return as soon as this hits zero */
+    smp_mb__before_atomic();
+    atomic_dec(&batch->pending);
+}
+
+void virtio_nic_ctrl_batch_init(struct virtio_nic_ctrl_batch *batch)
+{
+    atomic_set(&batch->pending, 0);
+    atomic_set(&batch->failed, 0);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_batch_init);
+
+/*
+ * Queue one command in @batch.  When the ring is full, what is queued so
+ * far is kicked and drained before retrying.
+ */
+int virtio_nic_ctrl_batch_add(struct virtio_nic_priv *priv, struct virtio_nic_ctrl_batch *batch,
+                              u8 class, u8 cmd, const void *data, size_t len)
+{
+    struct virtio_nic_ctrl_req *req;
+    int err;
+
+    req = virtio_nic_ctrl_req_alloc(class, cmd, data, len, GFP_KERNEL);
+    if (!req)
+        return -ENOMEM;
+    req->complete = virtio_nic_ctrl_batch_done;
+    req->ctx = batch;
+
+    atomic_inc(&batch->pending);
+    while ((err = virtio_nic_ctrl_submit(priv, req)) == -ENOSPC) {
+        virtio_nic_ctrl_kick(priv);
+        if (virtqueue_is_broken(priv->ctrl_vq))
+            break;
+        virtio_nic_ctrl_reap(priv);
+        cpu_relax();
+    }
+
+    if (err) {
+        atomic_dec(&batch->pending);
+        kfree(req);
+    }
+    return err;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_batch_add);
+
+/*
+ * Kick @batch and wait until the device has answered all of it.  The
+ * device answers control commands quickly, so we spin rather than sleep;
+ * the ctrl vq interrupt may complete some of them for us meanwhile.
+ */
+int virtio_nic_ctrl_batch_run(struct virtio_nic_priv *priv, struct virtio_nic_ctrl_batch *batch)
+{
+    virtio_nic_ctrl_kick(priv);
+
+    while (atomic_read_acquire(&batch->pending)) {
+        if (virtqueue_is_broken(priv->ctrl_vq))
+            return -EIO;
+        virtio_nic_ctrl_reap(priv);
+        cpu_relax();
+    }
+
+    return atomic_read(&batch->failed) ? -EIO : 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_batch_run);
+
+/*
+ * Send one command and wait for the device's ack: a batch of one.  @out is
+ * an optional sg table carrying the command payload, typically pointing
+ * into priv->ctrl, which ctrl_lock protects.
+ */
+bool virtio_nic_ctrl_cmd(struct virtio_nic_priv *priv, u8 class, u8 cmd,
+                         struct scatterlist *out)
+{
+    struct virtio_nic_ctrl_batch batch;
+    struct virtio_nic_ctrl_req *req;
+    int err;
+
+    if (!priv->ctrl_vq)
+        return false;
+
+    req = virtio_nic_ctrl_req_alloc(class, cmd, NULL, 0, GFP_KERNEL);
+    if (!req)
+        return false;
+    req->out = out;
+    req->complete = virtio_nic_ctrl_batch_done;
+    req->ctx = &batch;
+
+    virtio_nic_ctrl_batch_init(&batch);
+    atomic_inc(&batch.pending);
+
+    mutex_lock(&priv->ctrl_lock);
+    err = virtio_nic_ctrl_submit(priv, req);
+    if (err) {
+        dev_warn(&priv->vdev->dev, "ctrl %u.%u: failed to add buffer\n", class, cmd);
+        kfree(req);
+    } else {
+        err = virtio_nic_ctrl_batch_run(priv, &batch);
+    }
+    mutex_unlock(&priv->ctrl_lock);
+
+    return !err;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_ctrl_cmd);
+
+/*
+ * Tell the device how many queue pairs to use.  With RSS the count is part
+ * of the RSS configuration; with plain MQ the device otherwise keeps
+ * delivering to pair 0 only.
+ */
+int virtio_nic_set_queue_pairs(struct virtio_nic_priv *priv, u16 pairs)
+{
+    struct scatterlist sg;
+
+    if (!priv->has_mq)
+        return 0;
+
+    if (priv->has_rss)
+        return virtio_nic_rss_commit(priv);
+
+    pairs = virtio_nic_device_pairs(priv, pairs);
+    priv->ctrl->mq.virtqueue_pairs = cpu_to_virtio16(priv->vdev, pairs);
+    sg_init_one(&sg, &priv->ctrl->mq, sizeof(priv->ctrl->mq));
+
+    if (!virtio_nic_ctrl_cmd(priv, VIRTIO_NET_CTRL_MQ,
+                             VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET, &sg)) {
+        dev_warn(&priv->vdev->dev, "failed to set %u queue pairs\n", pairs);
+        return -EIO;
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_set_queue_pairs);
+
+/* Select which negotiated guest offloads the device applies to RX */
+int virtio_nic_set_guest_offloads(struct virtio_nic_priv *priv, u64 offloads)
+{
+    struct scatterlist sg;
+
+    if (!priv->has_offloads_ctrl)
+        return -EOPNOTSUPP;
+
+    priv->ctrl->offloads = cpu_to_virtio64(priv->vdev, offloads & priv->guest_offloads);
+    sg_init_one(&sg, &priv->ctrl->offloads, sizeof(priv->ctrl->offloads));
+
+    if (!virtio_nic_ctrl_cmd(priv, VIRTIO_NET_CTRL_GUEST_OFFLOADS,
+                             VIRTIO_NET_CTRL_GUEST_OFFLOADS_SET, &sg)) {
+        dev_warn(&priv->vdev->dev, "failed to set guest offloads 0x%llx\n", offloads);
+        return -EIO;
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_set_guest_offloads);
+
+static void virtio_nic_ctrl_async_done(struct virtio_nic_priv *priv,
+                                       struct virtio_nic_ctrl_req *req, bool ok)
+{
+    if (!ok)
+        dev_warn_ratelimited(&priv->vdev->dev, "ctrl %u.%u failed\n",
+                             req->hdr.class, req->hdr.cmd);
+    kfree(req);
+}
+
+/* Queue a fire-and-forget command; the caller kicks */
+static int virtio_nic_ctrl_send_async(struct virtio_nic_priv *priv, u8 class, u8 cmd,
+                                      const void *data, size_t len)
+{
+    struct virtio_nic_ctrl_req *req;
+    int err;
+
+    req = virtio_nic_ctrl_req_alloc(class, cmd, data, len, GFP_ATOMIC);
+    if (!req)
+        return -ENOMEM;
+    req->complete = virtio_nic_ctrl_async_done;
+
+    err = virtio_nic_ctrl_submit(priv, req);
+    if (err)
+        kfree(req);
+    return err;
+}
+
+/*
+ * ndo_set_rx_mode runs under the address list lock and must not wait, so
+ * the filter update is queued: one kick for all three commands, completed
+ * from the ctrl vq interrupt.
+ */
+void virtio_nic_set_rx_mode(struct net_device *ndev)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    struct virtio_net_ctrl_mac *uc, *mc;
+    struct netdev_hw_addr *ha;
+    size_t uc_len, mc_len;
+    u8 promisc, allmulti;
+    int uc_count, mc_count, i;
+    void *buf;
+
+    if (!priv->has_ctrl_rx)
+        return;
+
+    promisc = !!(ndev->flags & IFF_PROMISC);
+    allmulti = !!(ndev->flags & IFF_ALLMULTI);
+    uc_count = netdev_uc_count(ndev);
+    mc_count = netdev_mc_count(ndev);
+
+    /* MAC_TABLE_SET is the unicast table followed by the multicast one */
+    uc_len = sizeof(*uc) + uc_count * ETH_ALEN;
+    mc_len = sizeof(*mc) + mc_count * ETH_ALEN;
+    buf = kzalloc(uc_len + mc_len, GFP_ATOMIC);
+    if (!buf)
+        return;
+
+    uc = buf;
+    uc->entries = cpu_to_virtio32(priv->vdev, uc_count);
+    i = 0;
+    netdev_for_each_uc_addr(ha, ndev)
+        memcpy(uc->macs[i++], ha->addr, ETH_ALEN);
+
+    mc = buf + uc_len;
+    mc->entries = cpu_to_virtio32(priv->vdev, mc_count);
+    i = 0;
+    netdev_for_each_mc_addr(ha, ndev)
+        memcpy(mc->macs[i++], ha->addr, ETH_ALEN);
+
+    if (virtio_nic_ctrl_send_async(priv, VIRTIO_NET_CTRL_RX, VIRTIO_NET_CTRL_RX_PROMISC,
+                                   &promisc, sizeof(promisc)) ||
+        virtio_nic_ctrl_send_async(priv, VIRTIO_NET_CTRL_RX, VIRTIO_NET_CTRL_RX_ALLMULTI,
+                                   &allmulti, sizeof(allmulti)) ||
+        virtio_nic_ctrl_send_async(priv, VIRTIO_NET_CTRL_MAC, VIRTIO_NET_CTRL_MAC_TABLE_SET,
+                                   buf, uc_len + mc_len))
+        dev_warn_ratelimited(&priv->vdev->dev, "failed to queue RX mode update\n");
+
+    kfree(buf);
+    virtio_nic_ctrl_kick(priv);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_set_rx_mode);
+
+/*
+ * Program device notification coalescing.  With per-vq coalescing every
+ * active queue pair gets two commands; they go out as one batch, so 32
+ * queues cost one kick and one wait instead of 64 round trips.
+ */
+int virtio_nic_set_notf_coal(struct virtio_nic_priv *priv, u32 rx_usecs, u32 rx_frames,
+                             u32 tx_usecs, u32 tx_frames)
+{
+    struct virtio_nic_ctrl_batch batch;
+    int i, err = 0, run_err;
+
+    if (!priv->has_notf_coal && !priv->has_vq_notf_coal)
+        return -EOPNOTSUPP;
+
+    virtio_nic_ctrl_batch_init(&batch);
+
+    if (priv->has_vq_notf_coal) {
+        struct virtio_net_ctrl_coal_vq coal = {};
+
+        for (i = 0; i < priv->active_queues && !err; i++) {
+            coal.vqn = cpu_to_le16(i * 2);
+            coal.coal.max_usecs = cpu_to_le32(rx_usecs);
+            coal.coal.max_packets = cpu_to_le32(rx_frames);
+            err = virtio_nic_ctrl_batch_add(priv, &batch, VIRTIO_NET_CTRL_NOTF_COAL,
+                                            VIRTIO_NET_CTRL_NOTF_COAL_VQ_SET,
+                                            &coal, sizeof(coal));
+            if (err)
+                break;
+
+            coal.vqn = cpu_to_le16(i * 2 + 1);
+            coal.coal.max_usecs = cpu_to_le32(tx_usecs);
+            coal.coal.max_packets = cpu_to_le32(tx_frames);
+            err = virtio_nic_ctrl_batch_add(priv, &batch, VIRTIO_NET_CTRL_NOTF_COAL,
+                                            VIRTIO_NET_CTRL_NOTF_COAL_VQ_SET,
+                                            &coal, sizeof(coal));
+        }
+    } else {
+        struct virtio_net_ctrl_coal_rx rx = {
+            .rx_max_packets = cpu_to_le32(rx_frames),
+            .rx_usecs = cpu_to_le32(rx_usecs),
+        };
+        struct virtio_net_ctrl_coal_tx tx = {
+            .tx_max_packets = cpu_to_le32(tx_frames),
+            .tx_usecs = cpu_to_le32(tx_usecs),
+        };
+
+        err = virtio_nic_ctrl_batch_add(priv, &batch, VIRTIO_NET_CTRL_NOTF_COAL,
+                                        VIRTIO_NET_CTRL_NOTF_COAL_RX_SET, &rx, sizeof(rx));
+        if (!err)
+            err = virtio_nic_ctrl_batch_add(priv, &batch, VIRTIO_NET_CTRL_NOTF_COAL,
+                                            VIRTIO_NET_CTRL_NOTF_COAL_TX_SET, &tx, sizeof(tx));
+    }
+
+    /* Whatever made it onto the ring is waited for, even after an error */
+    run_err = virtio_nic_ctrl_batch_run(priv, &batch);
+    if (!err)
+        err = run_err;
+    if (err) {
+        dev_warn(&priv->vdev->dev, "failed to set notification coalescing: %d\n", err);
+        return err;
+    }
+
+    priv->coal_rx_usecs = rx_usecs;
+    priv->coal_rx_frames = rx_frames;
+    priv->coal_tx_usecs = tx_usecs;
+    priv->coal_tx_frames = tx_frames;
+    return 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_set_notf_coal);
+
+/* Module initialization */
+static int __init virtio_nic_ctrl_module_init(void)
+{
+    return 0;
+}
+
+static void __exit virtio_nic_ctrl_module_exit(void)
+{
+    /* Cleanup handled by main driver */
+}
+
+module_init(virtio_nic_ctrl_module_init);
+module_exit(virtio_nic_ctrl_module_exit);
+
+MODULE_DESCRIPTION("Control virtqueue commands for VirtIO NIC driver");
+MODULE_LICENSE("GPL");
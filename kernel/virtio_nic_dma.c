@@ -122,40 +122,6 @@ void virtio_nic_dma_free_buffer(struct virtio_nic_dma_buf *buf)
 }
 EXPORT_SYMBOL_GPL(virtio_nic_dma_free_buffer);
 
-/* Map sk_buff for zero-copy DMA */
-int virtio_nic_dma_map_skb(struct sk_buff *skb, struct scatterlist *sg, int *nents)
-{
-    struct skb_shared_info *shinfo = skb_shinfo(skb);
-    unsigned int i, nr_frags = shinfo->nr_frags;
-    int ret;
-
-    if (!skb || !sg || !nents)
-        return -EINVAL;
-
-    /* Handle linear part */
-    sg_init_table(sg, nr_frags + 1);
-    sg_set_buf(&sg[0], skb->data, skb_headlen(skb));
-
-    /* Handle fragments */
-    for (i = 0; i < nr_frags; i++) {
-        skb_frag_t *frag = &shinfo->frags[i];
-        sg_set_page(&sg[i + 1], skb_frag_page(frag),
-                   skb_frag_size(frag), skb_frag_off(frag));
-    }
-
-    *nents = nr_frags + 1;
-
-    /* Map for DMA */
-    ret = dma_map_sg(NULL, sg, *nents, DMA_TO_DEVICE);
-    if (ret == 0) {
-        *nents = 0;
-        return -ENOMEM;
-    }
-
-    return 0;
-}
-EXPORT_SYMBOL_GPL(virtio_nic_dma_map_skb);
-
 /* Initialize DMA buffer pools */
 int virtio_nic_dma_init_pools(void)
 {
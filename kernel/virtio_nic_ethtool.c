@@ -0,0 +1,274 @@
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/ethtool.h>
+#include <linux/log2.h>
+#include <linux/virtio_config.h>
+#include "virtio_nic.h"
+
+static int virtio_nic_get_rxnfc(struct net_device *ndev, struct ethtool_rxnfc *info,
+                                u32 *rule_locs)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    switch (info->cmd) {
+    case ETHTOOL_GRXRINGS:
+        info->data = priv->active_queues;
+        return 0;
+    default:
+        return -EOPNOTSUPP;
+    }
+}
+
+static void virtio_nic_get_channels(struct net_device *ndev, struct ethtool_channels *ch)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    ch->max_combined = priv->num_queues;
+    ch->combined_count = priv->active_queues;
+}
+
+/* Queue pairs are created at load (num_queues); -L picks how many are live */
+static int virtio_nic_set_channels(struct net_device *ndev, struct ethtool_channels *ch)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    if (ch->rx_count || ch->tx_count || ch->other_count)
+        return -EINVAL;
+
+    if (!ch->combined_count || ch->combined_count > priv->num_queues)
+        return -EINVAL;
+
+    return virtio_nic_set_active_queues(priv, ch->combined_count);
+}
+
+static void virtio_nic_get_ringparam(struct net_device *ndev, struct ethtool_ringparam *ring,
+                                     struct kernel_ethtool_ringparam *kring,
+                                     struct netlink_ext_ack *extack)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    struct virtio_nic_queue *q = &priv->queues[0];
+
+    ring->rx_max_pending = q->rx_vq->num_max;
+    ring->tx_max_pending = q->tx_vq->num_max;
+    ring->rx_pending = q->rx_ring_size;
+    ring->tx_pending = q->tx_ring_size;
+}
+
+/* Ring depth trades memory and queueing delay for burst absorption */
+static int virtio_nic_set_ringparam(struct net_device *ndev, struct ethtool_ringparam *ring,
+                                    struct kernel_ethtool_ringparam *kring,
+                                    struct netlink_ext_ack *extack)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    struct virtio_nic_queue *q = &priv->queues[0];
+
+    if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+        return -EINVAL;
+
+    if (ring->rx_pending == q->rx_ring_size && ring->tx_pending == q->tx_ring_size)
+        return 0;
+
+    if (!virtio_has_feature(priv->vdev, VIRTIO_F_RING_RESET)) {
+        NL_SET_ERR_MSG_MOD(extack, "device cannot reset queues, ring size is fixed");
+        return -EOPNOTSUPP;
+    }
+
+    if (!ring->rx_pending)
+        return -EINVAL;
+
+    if (ring->tx_pending <= q->tx_desc_reserve) {
+        NL_SET_ERR_MSG_MOD(extack, "TX ring must hold more than one worst-case packet");
+        return -EINVAL;
+    }
+
+    if (!virtio_has_feature(priv->vdev, VIRTIO_F_RING_PACKED) &&
+        (!is_power_of_2(ring->rx_pending) || !is_power_of_2(ring->tx_pending))) {
+        NL_SET_ERR_MSG_MOD(extack, "split rings must be a power of two in size");
+        return -EINVAL;
+    }
+
+    return virtio_nic_resize_rings(priv, ring->rx_pending, ring->tx_pending);
+}
+
+static u32 virtio_nic_get_rxfh_key_size(struct net_device *ndev)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    return priv->rss_key_size;
+}
+
+static u32 virtio_nic_get_rxfh_indir_size(struct net_device *ndev)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    return priv->rss_table_size;
+}
+
+static int virtio_nic_get_rxfh(struct net_device *ndev, struct ethtool_rxfh_param *rxfh)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    int i;
+
+    if (!priv->has_rss)
+        return -EOPNOTSUPP;
+
+    if (rxfh->indir) {
+        for (i = 0; i < priv->rss_table_size; i++)
+            rxfh->indir[i] = priv->rss_indir[i];
+    }
+    if (rxfh->key)
+        memcpy(rxfh->key, priv->rss_key, priv->rss_key_size);
+    rxfh->hfunc = ETH_RSS_HASH_TOP;
+
+    return 0;
+}
+
+/* Rebalance flows at runtime: the device picks up the new table immediately */
+static int virtio_nic_set_rxfh(struct net_device *ndev, struct ethtool_rxfh_param *rxfh,
+                               struct netlink_ext_ack *extack)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    u32 old_indir[VIRTIO_NIC_RSS_MAX_TABLE];
+    u8 old_key[VIRTIO_NIC_RSS_MAX_KEY];
+    int i, err;
+
+    if (!priv->has_rss)
+        return -EOPNOTSUPP;
+
+    if (rxfh->hfunc != ETH_RSS_HASH_NO_CHANGE && rxfh->hfunc != ETH_RSS_HASH_TOP) {
+        NL_SET_ERR_MSG_MOD(extack, "only the Toeplitz hash is supported");
+        return -EOPNOTSUPP;
+    }
+
+    if (!rxfh->indir && !rxfh->key)
+        return 0;
+
+    memcpy(old_indir, priv->rss_indir, sizeof(old_indir));
+    memcpy(old_key, priv->rss_key, sizeof(old_key));
+
+    if (rxfh->indir) {
+        for (i = 0; i < priv->rss_table_size; i++)
+            priv->rss_indir[i] = rxfh->indir[i];
+    }
+    if (rxfh->key)
+        memcpy(priv->rss_key, rxfh->key, priv->rss_key_size);
+
+    err = virtio_nic_rss_commit(priv);
+    if (err) {
+        memcpy(priv->rss_indir, old_indir, sizeof(old_indir));
+        memcpy(priv->rss_key, old_key, sizeof(old_key));
+        return err;
+    }
+
+    /* Bucket counts restart so hot buckets reflect the new mapping */
+    for (i = 0; i < priv->num_queues; i++) {
+        if (priv->queues[i].rss_bucket_hits)
+            memset(priv->queues[i].rss_bucket_hits, 0,
+                   priv->rss_table_size * sizeof(u64));
+    }
+
+    return 0;
+}
+
+static int virtio_nic_get_coalesce(struct net_device *ndev, struct ethtool_coalesce *ec,
+                                   struct kernel_ethtool_coalesce *kec,
+                                   struct netlink_ext_ack *extack)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    ec->rx_coalesce_usecs = priv->coal_rx_usecs;
+    ec->rx_max_coalesced_frames = priv->coal_rx_frames;
+    ec->tx_coalesce_usecs = priv->coal_tx_usecs;
+    ec->tx_max_coalesced_frames = priv->coal_tx_frames;
+
+    return 0;
+}
+
+/* Device-side notification coalescing, applied to every active queue at once */
+static int virtio_nic_set_coalesce(struct net_device *ndev, struct ethtool_coalesce *ec,
+                                   struct kernel_ethtool_coalesce *kec,
+                                   struct netlink_ext_ack *extack)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    if (!priv->has_notf_coal && !priv->has_vq_notf_coal) {
+        NL_SET_ERR_MSG_MOD(extack, "device does not support notification coalescing");
+        return -EOPNOTSUPP;
+    }
+
+    return virtio_nic_set_notf_coal(priv, ec->rx_coalesce_usecs, ec->rx_max_coalesced_frames,
+                                    ec->tx_coalesce_usecs, ec->tx_max_coalesced_frames);
+}
+
+static int virtio_nic_get_tunable(struct net_device *ndev,
+                                  const struct ethtool_tunable *tuna, void *data)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    switch (tuna->id) {
+    case ETHTOOL_RX_COPYBREAK:
+        *(u32 *)data = READ_ONCE(priv->rx_copybreak);
+        return 0;
+    default:
+        return -EOPNOTSUPP;
+    }
+}
+
+/* RX copy-break takes effect on the next poll; 0 turns it off */
+static int virtio_nic_set_tunable(struct net_device *ndev,
+                                  const struct ethtool_tunable *tuna, const void *data)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    u32 val = *(const u32 *)data;
+
+    switch (tuna->id) {
+    case ETHTOOL_RX_COPYBREAK:
+        if (val > VIRTIO_NIC_GOOD_PACKET_LEN)
+            return -EINVAL;
+        WRITE_ONCE(priv->rx_copybreak, val);
+        return 0;
+    default:
+        return -EOPNOTSUPP;
+    }
+}
+
+static const struct ethtool_ops virtio_nic_ethtool_ops = {
+    .supported_coalesce_params = ETHTOOL_COALESCE_USECS | ETHTOOL_COALESCE_MAX_FRAMES,
+    .get_link             = ethtool_op_get_link,
+    .get_channels         = virtio_nic_get_channels,
+    .set_channels         = virtio_nic_set_channels,
+    .get_ringparam        = virtio_nic_get_ringparam,
+    .set_ringparam        = virtio_nic_set_ringparam,
+    .get_rxnfc            = virtio_nic_get_rxnfc,
+    .get_rxfh_key_size    = virtio_nic_get_rxfh_key_size,
+    .get_rxfh_indir_size  = virtio_nic_get_rxfh_indir_size,
+    .get_rxfh             = virtio_nic_get_rxfh,
+    .set_rxfh             = virtio_nic_set_rxfh,
+    .get_coalesce         = virtio_nic_get_coalesce,
+    .set_coalesce         = virtio_nic_set_coalesce,
+    .get_tunable          = virtio_nic_get_tunable,
+    .set_tunable          = virtio_nic_set_tunable,
+};
+
+void virtio_nic_set_ethtool_ops(struct net_device *ndev)
+{
+    ndev->ethtool_ops = &virtio_nic_ethtool_ops;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_set_ethtool_ops);
+
+/* Module initialization */
+static int __init virtio_nic_ethtool_init(void)
+{
+    return 0;
+}
+
+static void __exit virtio_nic_ethtool_exit(void)
+{
+    /* Cleanup handled by main driver */
+}
+
+module_init(virtio_nic_ethtool_init);
+module_exit(virtio_nic_ethtool_exit);
+
+MODULE_DESCRIPTION("ethtool support for VirtIO NIC driver");
+MODULE_LICENSE("GPL");
@@ -7,10 +7,12 @@
 #include <linux/atomic.h>
 #include <linux/spinlock.h>
 #include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/bitmap.h>
 #include "virtio_nic.h"
 
 /* Failover configuration */
-static int failover_enabled = true;
+static bool failover_enabled = true;
 static int health_check_interval_ms = 1000;
 static int max_failover_count = 3;
 static int queue_failure_threshold = 1000;
@@ -27,6 +29,7 @@ MODULE_PARM_DESC(queue_failure_threshold, "Queue failure threshold");
 
 /* Failover state tracking */
 struct virtio_nic_failover_state {
+    struct virtio_nic_priv *priv;
     atomic_t failover_count;
     atomic_t active_queues;
     atomic_t failed_queues;
@@ -35,6 +38,7 @@ struct virtio_nic_failover_state {
     struct workqueue_struct *failover_wq;
     struct list_head failed_queue_list;
     spinlock_t failed_queue_lock;
+    struct delayed_work recovery_work;
 };
 
 /* Failed queue tracking */
@@ -46,6 +50,156 @@ struct virtio_nic_failed_queue {
     struct list_head list;
 };
 
+static void virtio_nic_health_check_timer(struct timer_list *t);
+static void virtio_nic_queue_recovery_work(struct work_struct *work);
+
+/*
+ * Start a TX steering update: a private copy of the published table, with
+ * tx_steer_lock held until virtio_nic_steer_commit().  NULL if out of memory.
+ */
+static struct virtio_nic_tx_steer *virtio_nic_steer_begin(struct virtio_nic_priv *priv,
+                                                          unsigned long *flags)
+{
+    struct virtio_nic_tx_steer *steer, *old;
+
+    steer = kmalloc(sizeof(*steer), GFP_ATOMIC);
+    if (!steer)
+        return NULL;
+
+    spin_lock_irqsave(&priv->tx_steer_lock, *flags);
+    old = rcu_dereference_protected(priv->tx_steer, lockdep_is_held(&priv->tx_steer_lock));
+    if (old)
+        memcpy(steer, old, sizeof(*steer));
+    else
+        memset(steer, 0, sizeof(*steer));
+
+    return steer;
+}
+
+/* Publish the copy; the very next packet selects its queue with it */
+static void virtio_nic_steer_commit(struct virtio_nic_priv *priv,
+                                    struct virtio_nic_tx_steer *steer, unsigned long flags)
+{
+    struct virtio_nic_tx_steer *old;
+
+    old = rcu_dereference_protected(priv->tx_steer, lockdep_is_held(&priv->tx_steer_lock));
+
+    /* Nothing left to steer around: back to the stack's own pick */
+    if (bitmap_empty(steer->failed, VIRTIO_NIC_MAX_QUEUES) && !steer->nr_overrides) {
+        kfree(steer);
+        steer = NULL;
+    }
+
+    rcu_assign_pointer(priv->tx_steer, steer);
+    spin_unlock_irqrestore(&priv->tx_steer_lock, flags);
+
+    if (old)
+        kfree_rcu(old, rcu);
+}
+
+static void virtio_nic_steer_add_flow(struct virtio_nic_tx_steer *steer, u32 flow_id,
+                                      int from, int to)
+{
+    struct virtio_nic_flow_override *e = &steer->flows[flow_id & (VIRTIO_NIC_FLOW_OVERRIDES - 1)];
+
+    if (!e->valid)
+        steer->nr_overrides++;
+    e->flow_id = flow_id;
+    e->from = from;
+    e->to = to;
+    e->valid = true;
+}
+
+/* Take a queue out of TX selection; @target -1 spreads it over healthy queues */
+void virtio_nic_steer_queue_failed(struct virtio_nic_priv *priv, int queue_id, int target)
+{
+    struct virtio_nic_tx_steer *steer;
+    unsigned long flags;
+
+    steer = virtio_nic_steer_begin(priv, &flags);
+    if (!steer)
+        return;
+
+    set_bit(queue_id, steer->failed);
+    steer->redirect[queue_id] = target;
+    virtio_nic_steer_commit(priv, steer, flags);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_steer_queue_failed);
+
+/* Put a queue back into TX selection; flows moved off it return home */
+static void virtio_nic_steer_queue_healthy(struct virtio_nic_priv *priv, int queue_id)
+{
+    struct virtio_nic_tx_steer *steer;
+    unsigned long flags;
+    int i;
+
+    steer = virtio_nic_steer_begin(priv, &flags);
+    if (!steer)
+        return;
+
+    clear_bit(queue_id, steer->failed);
+    for (i = 0; i < VIRTIO_NIC_FLOW_OVERRIDES; i++) {
+        if (steer->flows[i].valid && steer->flows[i].from == queue_id) {
+            steer->flows[i].valid = false;
+            steer->nr_overrides--;
+        }
+    }
+    virtio_nic_steer_commit(priv, steer, flags);
+}
+
+/*
+ * ndo_select_queue: the stack's usual pick, then steered around failures.
+ * A pinned flow goes where it was moved; a packet bound for a failed queue
+ * goes to that queue's redirect, or else the next healthy queue.  With an
+ * empty steering table this is netdev_pick_tx() plus one RCU load.
+ */
+u16 virtio_nic_select_queue(struct net_device *ndev, struct sk_buff *skb,
+                            struct net_device *sb_dev)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    unsigned int n = ndev->real_num_tx_queues;
+    u16 txq = netdev_pick_tx(ndev, skb, sb_dev);
+    struct virtio_nic_flow_override *e;
+    struct virtio_nic_tx_steer *steer;
+    int i, target = txq;
+    u32 flow_id;
+
+    rcu_read_lock();
+    steer = rcu_dereference(priv->tx_steer);
+    if (likely(!steer))
+        goto out;
+
+    /* Keyed as virtio_nic_enqueue() keys its flow records */
+    flow_id = skb_get_hash(skb) % 0xFFFF;
+    e = &steer->flows[flow_id & (VIRTIO_NIC_FLOW_OVERRIDES - 1)];
+    if (e->valid && e->flow_id == flow_id && e->to < n && !test_bit(e->to, steer->failed)) {
+        target = e->to;
+        goto out;
+    }
+
+    if (!test_bit(txq, steer->failed))
+        goto out;
+
+    target = steer->redirect[txq];
+    if (target < 0 || target >= n || test_bit(target, steer->failed)) {
+        /* With every queue failed there is nothing better than the pick */
+        target = txq;
+        for (i = 1; i < n; i++) {
+            if (!test_bit((txq + i) % n, steer->failed)) {
+                target = (txq + i) % n;
+                break;
+            }
+        }
+    }
+
+out:
+    rcu_read_unlock();
+    if (target != txq)
+        atomic_long_inc(&priv->queues[txq].tx_steered);
+    return target;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_select_queue);
+
 /* Initialize failover mechanism */
 void virtio_nic_init_failover(struct virtio_nic_priv *priv)
 {
@@ -58,12 +212,14 @@ void virtio_nic_init_failover(struct virtio_nic_priv *priv)
     if (!failover)
         return;
 
+    failover->priv = priv;
     atomic_set(&failover->failover_count, 0);
     atomic_set(&failover->active_queues, priv->num_queues);
     atomic_set(&failover->failed_queues, 0);
     spin_lock_init(&failover->failover_lock);
     spin_lock_init(&failover->failed_queue_lock);
     INIT_LIST_HEAD(&failover->failed_queue_list);
+    INIT_DELAYED_WORK(&failover->recovery_work, virtio_nic_queue_recovery_work);
 
     /* Create workqueue for failover operations */
     failover->failover_wq = create_singlethread_workqueue("virtio_nic_failover");
@@ -73,7 +229,7 @@ void virtio_nic_init_failover(struct virtio_nic_priv *priv)
     }
 
     /* Setup health check timer */
-    setup_timer(&failover->health_check_timer, virtio_nic_health_check_timer, (unsigned long)priv);
+    timer_setup(&failover->health_check_timer, virtio_nic_health_check_timer, 0);
     mod_timer(&failover->health_check_timer, 
               jiffies + msecs_to_jiffies(health_check_interval_ms));
 
@@ -81,17 +237,32 @@ void virtio_nic_init_failover(struct virtio_nic_priv *priv)
 }
 EXPORT_SYMBOL_GPL(virtio_nic_init_failover);
 
+/* Stop the health check so nothing queues a reset any more */
+void virtio_nic_stop_failover(struct virtio_nic_priv *priv)
+{
+    struct virtio_nic_failover_state *failover = priv->failover_state;
+
+    if (failover)
+        del_timer_sync(&failover->health_check_timer);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_stop_failover);
+
 /* Cleanup failover mechanism */
 void virtio_nic_cleanup_failover(struct virtio_nic_priv *priv)
 {
     struct virtio_nic_failover_state *failover = priv->failover_state;
     struct virtio_nic_failed_queue *failed_q, *tmp;
 
+    /* No packets are in flight once the netdev is unregistered */
+    kfree(rcu_dereference_protected(priv->tx_steer, true));
+    RCU_INIT_POINTER(priv->tx_steer, NULL);
+
     if (!failover)
         return;
 
-    /* Cancel health check timer */
+    /* Cancel health check timer, then the recovery it may have queued */
     del_timer_sync(&failover->health_check_timer);
+    cancel_delayed_work_sync(&failover->recovery_work);
 
     /* Cleanup failed queue list */
     spin_lock(&failover->failed_queue_lock);
@@ -112,13 +283,13 @@ void virtio_nic_cleanup_failover(struct virtio_nic_priv *priv)
 EXPORT_SYMBOL_GPL(virtio_nic_cleanup_failover);
 
 /* Health check timer callback */
-void virtio_nic_health_check_timer(unsigned long data)
+static void virtio_nic_health_check_timer(struct timer_list *t)
 {
-    struct virtio_nic_priv *priv = (struct virtio_nic_priv *)data;
-    struct virtio_nic_failover_state *failover = priv->failover_state;
+    struct virtio_nic_failover_state *failover = from_timer(failover, t, health_check_timer);
+    struct virtio_nic_priv *priv = failover->priv;
     int i;
 
-    if (!failover || !failover_enabled)
+    if (!failover_enabled)
         return;
 
     /* Check all queues for failures */
@@ -139,15 +310,21 @@ void virtio_nic_health_check_timer(unsigned long data)
               jiffies + msecs_to_jiffies(health_check_interval_ms));
 }
 
-/* Handle queue failure */
-void virtio_nic_queue_failed(struct virtio_nic_priv *priv, int queue_id)
+/*
+ * Take a queue out of service: steer TX away at once and put it on the
+ * failed list.  Unless a reset brings it back first, the recovery work
+ * returns it once the recovery window has passed.  False without failover.
+ */
+bool virtio_nic_queue_mark_failed(struct virtio_nic_priv *priv, int queue_id)
 {
     struct virtio_nic_failover_state *failover = priv->failover_state;
     struct virtio_nic_failed_queue *failed_q;
     unsigned long flags;
 
     if (!failover || queue_id >= priv->num_queues)
-        return;
+        return false;
+
+    virtio_nic_steer_queue_failed(priv, queue_id, -1);
 
     spin_lock_irqsave(&failover->failed_queue_lock, flags);
     
@@ -175,17 +352,61 @@ void virtio_nic_queue_failed(struct virtio_nic_priv *priv, int queue_id)
 out:
     spin_unlock_irqrestore(&failover->failed_queue_lock, flags);
 
-    /* Trigger queue remapping */
+    queue_delayed_work(failover->failover_wq, &failover->recovery_work,
+                       msecs_to_jiffies(VIRTIO_NIC_RECOVERY_WINDOW_MS));
+    return true;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_queue_mark_failed);
+
+/* Handle queue failure */
+void virtio_nic_queue_failed(struct virtio_nic_priv *priv, int queue_id)
+{
+    struct virtio_nic_failover_state *failover = priv->failover_state;
+
+    if (!virtio_nic_queue_mark_failed(priv, queue_id))
+        return;
+
+    /* Reset the queue in process context; it remaps flows if it cannot */
     if (atomic_read(&failover->failover_count) < max_failover_count) {
         atomic_inc(&failover->failover_count);
-        virtio_nic_remap_queue(priv, queue_id, -1);
+        schedule_work(&priv->queues[queue_id].failover_work);
     }
 }
 
+/* A reset brought the queue back: it is healthy again from now on */
+void virtio_nic_queue_recovered(struct virtio_nic_priv *priv, int queue_id)
+{
+    struct virtio_nic_failover_state *failover = priv->failover_state;
+    struct virtio_nic_failed_queue *failed_q, *tmp;
+    unsigned long flags;
+
+    virtio_nic_steer_queue_healthy(priv, queue_id);
+
+    if (!failover)
+        return;
+
+    spin_lock_irqsave(&failover->failed_queue_lock, flags);
+    list_for_each_entry_safe(failed_q, tmp, &failover->failed_queue_list, list) {
+        if (failed_q->queue_id != queue_id)
+            continue;
+
+        list_del(&failed_q->list);
+        kfree(failed_q);
+        atomic_dec(&failover->failed_queues);
+        atomic_inc(&failover->active_queues);
+        break;
+    }
+    spin_unlock_irqrestore(&failover->failed_queue_lock, flags);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_queue_recovered);
+
 /* Remap queue to new target */
 int virtio_nic_remap_queue(struct virtio_nic_priv *priv, int old_queue, int new_queue)
 {
+    struct virtio_nic_tx_steer *steer;
+    struct virtio_nic_flow *flow;
     struct virtio_nic_queue *q;
+    unsigned long flags;
     int target_queue;
 
     if (!priv || old_queue >= priv->num_queues)
@@ -193,7 +414,7 @@ int virtio_nic_remap_queue(struct virtio_nic_priv *priv, int old_queue, int new_
 
     /* Find available queue if new_queue is -1 */
     if (new_queue == -1) {
-        target_queue = virtio_nic_find_available_queue(priv);
+        target_queue = virtio_nic_find_available_queue(priv, old_queue);
         if (target_queue < 0)
             return -ENOMEM;
     } else {
@@ -202,6 +423,20 @@ int virtio_nic_remap_queue(struct virtio_nic_priv *priv, int old_queue, int new_
 
     q = &priv->queues[old_queue];
 
+    /* Pin the queue's known flows to the target before moving their records */
+    steer = virtio_nic_steer_begin(priv, &flags);
+    if (steer) {
+        set_bit(old_queue, steer->failed);
+        steer->redirect[old_queue] = target_queue;
+
+        spin_lock(&q->flow_lock);
+        list_for_each_entry(flow, &q->flow_list, list)
+            virtio_nic_steer_add_flow(steer, flow->flow_id, old_queue, target_queue);
+        spin_unlock(&q->flow_lock);
+
+        virtio_nic_steer_commit(priv, steer, flags);
+    }
+
     /* Reassign flows from failed queue to new queue */
     virtio_nic_reassign_queue_flows(priv, old_queue, target_queue);
 
@@ -215,28 +450,54 @@ int virtio_nic_remap_queue(struct virtio_nic_priv *priv, int old_queue, int new_
 }
 EXPORT_SYMBOL_GPL(virtio_nic_remap_queue);
 
-/* Find available queue for failover */
-int virtio_nic_find_available_queue(struct virtio_nic_priv *priv)
+/* Whether @queue_id is on the failed list; failed_queue_lock held */
+static bool virtio_nic_queue_is_failed(struct virtio_nic_failover_state *failover, int queue_id)
+{
+    struct virtio_nic_failed_queue *failed_q;
+
+    list_for_each_entry(failed_q, &failover->failed_queue_list, list) {
+        if (failed_q->queue_id == queue_id)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Find a queue to take over @failed's flows: the active queue with the
+ * fewest errors that has not failed itself and is not steered around.
+ * -1 if none is left.
+ */
+int virtio_nic_find_available_queue(struct virtio_nic_priv *priv, int failed)
 {
-    int i;
     struct virtio_nic_failover_state *failover = priv->failover_state;
+    struct virtio_nic_tx_steer *steer;
+    u64 min_errors = U64_MAX;
+    int best_queue = -1;
+    unsigned long flags;
+    int i;
 
     if (!failover)
         return -1;
 
-    /* Find queue with lowest error rate */
-    int best_queue = -1;
-    u64 min_errors = U64_MAX;
-
-    for (i = 0; i < priv->num_queues; i++) {
+    rcu_read_lock();
+    steer = rcu_dereference(priv->tx_steer);
+    spin_lock_irqsave(&failover->failed_queue_lock, flags);
+    for (i = 0; i < priv->active_queues; i++) {
         struct virtio_nic_queue *q = &priv->queues[i];
         u64 total_errors = q->rx_errors + q->tx_errors;
-        
+
+        if (i == failed || virtio_nic_queue_is_failed(failover, i))
+            continue;
+        if (steer && test_bit(i, steer->failed))
+            continue;
+
         if (total_errors < min_errors) {
             min_errors = total_errors;
             best_queue = i;
         }
     }
+    spin_unlock_irqrestore(&failover->failed_queue_lock, flags);
+    rcu_read_unlock();
 
     return best_queue;
 }
@@ -275,6 +536,8 @@ void virtio_nic_flow_reassign(struct virtio_nic_priv *priv, u32 flow_id, int new
 {
     int i;
     struct virtio_nic_flow *flow;
+    struct virtio_nic_tx_steer *steer;
+    unsigned long steer_flags;
 
     if (!priv || new_queue >= priv->num_queues)
         return;
@@ -287,17 +550,25 @@ void virtio_nic_flow_reassign(struct virtio_nic_priv *priv, u32 flow_id, int new
         spin_lock_irqsave(&q->flow_lock, flags);
         list_for_each_entry(flow, &q->flow_list, list) {
             if (flow->flow_id == flow_id) {
+                struct virtio_nic_queue *new_q = &priv->queues[new_queue];
+
                 /* Move flow to new queue */
                 list_del(&flow->list);
                 flow->queue_id = new_queue;
                 
                 /* Add to new queue */
-                struct virtio_nic_queue *new_q = &priv->queues[new_queue];
                 spin_lock(&new_q->flow_lock);
                 list_add_tail(&flow->list, &new_q->flow_list);
                 spin_unlock(&new_q->flow_lock);
                 
                 spin_unlock_irqrestore(&q->flow_lock, flags);
+
+                /* Its packets follow from the next one on */
+                steer = virtio_nic_steer_begin(priv, &steer_flags);
+                if (steer) {
+                    virtio_nic_steer_add_flow(steer, flow_id, i, new_queue);
+                    virtio_nic_steer_commit(priv, steer, steer_flags);
+                }
                 return;
             }
         }
@@ -311,6 +582,7 @@ void virtio_nic_get_failover_stats(struct virtio_nic_priv *priv, struct virtio_n
 {
     struct virtio_nic_failover_state *failover = priv->failover_state;
     struct virtio_nic_failed_queue *failed_q;
+    unsigned long flags;
 
     if (!failover || !stats)
         return;
@@ -323,54 +595,79 @@ void virtio_nic_get_failover_stats(struct virtio_nic_priv *priv, struct virtio_n
     stats->enabled = failover_enabled;
     
     /* Count failed queues */
-    spin_lock(&failover->failed_queue_lock);
+    spin_lock_irqsave(&failover->failed_queue_lock, flags);
     list_for_each_entry(failed_q, &failover->failed_queue_list, list) {
         stats->total_failures++;
         if (failed_q->failure_count > stats->max_failure_count) {
             stats->max_failure_count = failed_q->failure_count;
         }
     }
-    spin_unlock(&failover->failed_queue_lock);
+    spin_unlock_irqrestore(&failover->failed_queue_lock, flags);
 }
 EXPORT_SYMBOL_GPL(virtio_nic_get_failover_stats);
 
-/* Recovery mechanism for failed queues */
-void virtio_nic_queue_recovery_work(struct work_struct *work)
+/*
+ * One recovery pass at @now for failed queues that no reset brought back:
+ * once the window has passed since a queue's last failure its error
+ * counters start over, TX may use it again and the health check judges it
+ * afresh.  Returns the ms until the next window ends, 0 if none is left.
+ */
+s64 virtio_nic_failover_recover(struct virtio_nic_priv *priv, ktime_t now)
 {
-    struct virtio_nic_priv *priv = container_of(work, struct virtio_nic_priv, recovery_work);
     struct virtio_nic_failover_state *failover = priv->failover_state;
     struct virtio_nic_failed_queue *failed_q, *tmp;
+    struct virtio_nic_queue *q;
+    s64 age, next = 0;
     unsigned long flags;
-    ktime_t now = ktime_get();
+    int queue_id;
 
     if (!failover)
-        return;
+        return 0;
 
     spin_lock_irqsave(&failover->failed_queue_lock, flags);
     
     list_for_each_entry_safe(failed_q, tmp, &failover->failed_queue_list, list) {
-        /* Check if queue has recovered */
-        if (ktime_to_ms(ktime_sub(now, failed_q->last_failure)) > 5000) { /* 5 second recovery window */
-            struct virtio_nic_queue *q = &priv->queues[failed_q->queue_id];
-            
-            /* Reset error counters */
-            q->rx_errors = 0;
-            q->tx_errors = 0;
-            
-            /* Remove from failed list */
-            list_del(&failed_q->list);
-            kfree(failed_q);
-            
-            atomic_dec(&failover->failed_queues);
-            atomic_inc(&failover->active_queues);
-            
-            dev_info(&priv->vdev->dev, "Queue %d recovered\n", failed_q->queue_id);
+        age = ktime_ms_delta(now, failed_q->last_failure);
+        if (age < VIRTIO_NIC_RECOVERY_WINDOW_MS) {
+            if (!next || VIRTIO_NIC_RECOVERY_WINDOW_MS - age < next)
+                next = VIRTIO_NIC_RECOVERY_WINDOW_MS - age;
+            continue;
         }
+
+        queue_id = failed_q->queue_id;
+        q = &priv->queues[queue_id];
+
+        /* Reset error counters */
+        q->rx_errors = 0;
+        q->tx_errors = 0;
+
+        /* Remove from failed list */
+        list_del(&failed_q->list);
+        kfree(failed_q);
+
+        atomic_dec(&failover->failed_queues);
+        atomic_inc(&failover->active_queues);
+        virtio_nic_steer_queue_healthy(priv, queue_id);
+
+        dev_info(&priv->vdev->dev, "Queue %d recovered\n", queue_id);
     }
     
     spin_unlock_irqrestore(&failover->failed_queue_lock, flags);
+    return next;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_failover_recover);
+
+/* Recovery work: a pass now, then again when the next window ends */
+static void virtio_nic_queue_recovery_work(struct work_struct *work)
+{
+    struct virtio_nic_failover_state *failover =
+        container_of(to_delayed_work(work), struct virtio_nic_failover_state, recovery_work);
+    s64 next = virtio_nic_failover_recover(failover->priv, ktime_get());
+
+    if (next)
+        queue_delayed_work(failover->failover_wq, &failover->recovery_work,
+                           msecs_to_jiffies(next));
 }
-EXPORT_SYMBOL_GPL(virtio_nic_queue_recovery_work);
 
 /* Module initialization */
 static int __init virtio_nic_failover_init(void)
@@ -34,20 +34,65 @@ static irqreturn_t virtio_nic_interrupt(int irq, void *data)
         return IRQ_NONE;
 
     start_time = ktime_get();
+    /* One vector serves the pair; charge it to RX */
+    q->rx_irqs++;
 
-    /* Check if we should disable callbacks */
-    if (virtqueue_disable_cb(q->vq)) {
-        /* Schedule NAPI for packet processing */
-        napi_schedule(&q->napi);
-        
-        /* Record interrupt latency for telemetry */
-        latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start_time));
-        telemetry_record_latency(latency_ns);
-    }
+    /* RX and TX completions share the queue's NAPI context */
+    virtqueue_disable_cb(q->rx_vq);
+    virtqueue_disable_cb(q->tx_vq);
+
+    /* Schedule NAPI for packet processing */
+    napi_schedule(&q->napi);
+
+    /* Record interrupt latency for telemetry */
+    latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start_time));
+    telemetry_record_latency(latency_ns);
 
     return IRQ_HANDLED;
 }
 
+/* Virtqueue callback: vqs are laid out as rx0, tx0, rx1, tx1, ... */
+void virtio_nic_vq_callback(struct virtqueue *vq)
+{
+    struct virtio_nic_priv *priv = vq->vdev->priv;
+    struct virtio_nic_queue *q = &priv->queues[vq->index / 2];
+
+    if (vq->index % 2)
+        q->tx_irqs++;
+    else
+        q->rx_irqs++;
+
+    virtqueue_disable_cb(vq);
+    napi_schedule(&q->napi);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_vq_callback);
+
+/*
+ * Spread the active queue pairs' interrupts over the CPUs near the device,
+ * one CPU per pair; inactive pairs give up their affinity.
+ */
+void virtio_nic_set_affinity(struct virtio_nic_priv *priv)
+{
+    int node = dev_to_node(&priv->vdev->dev);
+    int i;
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+        const struct cpumask *mask = NULL;
+
+        if (i < priv->active_queues) {
+            q->cpu_id = cpumask_local_spread(i, node);
+            mask = cpumask_of(q->cpu_id);
+        }
+
+        virtqueue_set_affinity(q->rx_vq, mask);
+        virtqueue_set_affinity(q->tx_vq, mask);
+        if (q->irq > 0)
+            irq_set_affinity_hint(q->irq, mask);
+    }
+}
+EXPORT_SYMBOL_GPL(virtio_nic_set_affinity);
+
 /* Setup MSI-X interrupts with NUMA awareness */
 int virtio_nic_setup_msix(struct virtio_nic_priv *priv)
 {
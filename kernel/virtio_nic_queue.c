@@ -1,33 +1,252 @@
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/virtio_config.h>
+#include <linux/virtio_ring.h>
 #include <linux/numa.h>
 #include <linux/cpumask.h>
 #include <linux/timer.h>
 #include <linux/workqueue.h>
 #include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/ethtool.h>
+#include <net/xdp_sock_drv.h>
 #include "virtio_nic.h"
 
 /* Queue scheduling parameters */
 static int queue_weight = 64;
 static int adaptive_threshold = 1000; /* packets per second */
 static bool enable_adaptive_scheduling = true;
+static int xdp_tx_queues = -1;
+static unsigned int tx_copybreak = 256;
 
 module_param(queue_weight, int, 0644);
 module_param(adaptive_threshold, int, 0644);
 module_param(enable_adaptive_scheduling, bool, 0644);
+module_param(xdp_tx_queues, int, 0444);
+module_param(tx_copybreak, uint, 0444);
 
 MODULE_PARM_DESC(queue_weight, "NAPI weight for queue processing");
 MODULE_PARM_DESC(adaptive_threshold, "Threshold for adaptive scheduling");
 MODULE_PARM_DESC(enable_adaptive_scheduling, "Enable adaptive queue scheduling");
+MODULE_PARM_DESC(xdp_tx_queues, "Dedicated XDP TX queues (-1: one per CPU, 0: none)");
+MODULE_PARM_DESC(tx_copybreak, "Copy TX packets up to this size into a per-slot buffer (0: off)");
+
+/*
+ * Slot tables for a TX ring of @size entries.  The copy slab is an
+ * optimisation only: without it every packet takes the skb path.
+ */
+static int virtio_nic_tx_slots_alloc(struct virtio_nic_queue *q, unsigned int size,
+                                     struct virtio_nic_tx_slot **slots, u16 **free,
+                                     u8 **slab)
+{
+    unsigned int copybreak = L1_CACHE_ALIGN(min_t(unsigned int, tx_copybreak,
+                                                  VIRTIO_NIC_TX_COPYBREAK_MAX));
+
+    *slots = kcalloc_node(size, sizeof(**slots), GFP_KERNEL, q->numa_node);
+    if (!*slots)
+        return -ENOMEM;
+
+    *free = kcalloc_node(size, sizeof(**free), GFP_KERNEL, q->numa_node);
+    if (!*free) {
+        kfree(*slots);
+        *slots = NULL;
+        return -ENOMEM;
+    }
+
+    *slab = copybreak ? kmalloc_array_node(size, copybreak, GFP_KERNEL, q->numa_node) :
+                        NULL;
+    return 0;
+}
+
+/* Make freshly allocated tables the queue's own, every slot free */
+static void virtio_nic_tx_slots_install(struct virtio_nic_queue *q, unsigned int size,
+                                        struct virtio_nic_tx_slot *slots, u16 *free,
+                                        u8 *slab)
+{
+    unsigned int i;
+
+    q->tx_ring_size = size;
+    q->tx_slots = slots;
+    q->tx_free = free;
+    for (i = 0; i < size; i++)
+        q->tx_free[i] = i;
+    q->tx_free_top = size;
+    q->tx_head = 0;
+    q->tx_inflight = 0;
+
+    /*
+     * Small packets are copied into a per-slot buffer so the skb can be
+     * freed at once and no frag list is built for them.  With an IOMMU the
+     * virtio core still maps the slab entry on every add.
+     */
+    q->tx_copy_slab = slab;
+    q->tx_copybreak = slab ? L1_CACHE_ALIGN(min_t(unsigned int, tx_copybreak,
+                                                  VIRTIO_NIC_TX_COPYBREAK_MAX)) : 0;
+}
+
+/* Allocate the per-queue TX slot table, one slot per TX ring entry */
+static int virtio_nic_alloc_tx_slots(struct virtio_nic_queue *q)
+{
+    unsigned int size = virtqueue_get_vring_size(q->tx_vq);
+    struct virtio_nic_tx_slot *slots;
+    u16 *free;
+    u8 *slab;
+    int err;
+
+    err = virtio_nic_tx_slots_alloc(q, size, &slots, &free, &slab);
+    if (err)
+        return err;
+
+    virtio_nic_tx_slots_install(q, size, slots, free, slab);
+    return 0;
+}
+
+static void virtio_nic_free_tx_slots(struct virtio_nic_queue *q)
+{
+    kfree(q->tx_copy_slab);
+    q->tx_copy_slab = NULL;
+    q->tx_copybreak = 0;
+    kfree(q->tx_free);
+    kfree(q->tx_slots);
+    q->tx_free = NULL;
+    q->tx_slots = NULL;
+    q->tx_free_top = 0;
+}
+
+/*
+ * Release one TX buffer the device will never complete.  Used when the
+ * device has been reset and as the virtqueue_reset() recycle callback.
+ */
+void virtio_nic_tx_recycle(struct virtqueue *vq, void *buf)
+{
+    struct virtio_nic_priv *priv = vq->vdev->priv;
+    struct virtio_nic_queue *q = &priv->queues[vq->index / 2];
+    struct virtio_nic_tx_slot *slot = buf;
+
+    /* An AF_XDP frame still owes the socket its completion */
+    if (slot->xsk) {
+        if (q->xsk_pool)
+            xsk_tx_completed(q->xsk_pool, 1);
+    } else if (!slot->copied) {
+        dev_kfree_skb_any(slot->skb);
+    }
+    virtio_nic_tx_slot_put(q, slot);
+    atomic_dec(&q->pending_packets);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_tx_recycle);
+
+/* Drop TX packets the device never completed (device already reset) */
+static void virtio_nic_tx_free_unused(struct virtio_nic_queue *q)
+{
+    void *buf;
+
+    if (!q->tx_vq || !q->tx_slots)
+        return;
+
+    while ((buf = virtqueue_detach_unused_buf(q->tx_vq)) != NULL)
+        virtio_nic_tx_recycle(q->tx_vq, buf);
+
+    netdev_tx_reset_queue(virtio_nic_txq(q));
+}
+
+/*
+ * Queue pairs to instantiate.  The control vq sits after every pair the
+ * device has, so with one we must create them all, used or not.
+ */
+static unsigned int virtio_nic_total_pairs(struct virtio_nic_priv *priv, unsigned int nxdp)
+{
+    unsigned int npairs = priv->num_queues + nxdp;
+
+    if (priv->has_cvq)
+        npairs = max(npairs, priv->max_queue_pairs);
+    return npairs;
+}
+
+/*
+ * Find the data queue pairs followed by @nxdp extra pairs whose TX ring is
+ * reserved for XDP, any unused pairs, then the control vq.  Pairs stay
+ * whole so vq indices match the device layout; the RX half of an XDP pair
+ * is never posted to.
+ */
+static int virtio_nic_find_vqs(struct virtio_nic_priv *priv, unsigned int nxdp,
+                               struct virtqueue **vqs)
+{
+    unsigned int npairs = virtio_nic_total_pairs(priv, nxdp);
+    vq_callback_t **callbacks;
+    const char **names;
+    bool *ctx;
+    int i, err, nvqs;
+
+    nvqs = npairs * 2 + priv->has_cvq;
+    callbacks = kcalloc(nvqs, sizeof(*callbacks), GFP_KERNEL);
+    names = kcalloc(nvqs, sizeof(*names), GFP_KERNEL);
+    ctx = kcalloc(nvqs, sizeof(*ctx), GFP_KERNEL);
+    if (!callbacks || !names || !ctx) {
+        err = -ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+
+        snprintf(q->rx_name, sizeof(q->rx_name), "rx%d", i);
+        snprintf(q->tx_name, sizeof(q->tx_name), "tx%d", i);
+        names[i * 2] = q->rx_name;
+        names[i * 2 + 1] = q->tx_name;
+        callbacks[i * 2] = virtio_nic_vq_callback;
+        callbacks[i * 2 + 1] = virtio_nic_vq_callback;
+        /* RX tokens carry the buffer truesize, which varies when mergeable */
+        ctx[i * 2] = true;
+    }
+
+    /* XDP TX completions are reaped on the next transmit, no callback */
+    for (i = 0; i < nxdp; i++) {
+        struct virtio_nic_xdp_sq *sq = &priv->xdp_sqs[i];
+        int idx = (priv->num_queues + i) * 2;
+
+        snprintf(sq->name, sizeof(sq->name), "xdp_tx%d", i);
+        names[idx] = "xdp_rx_unused";
+        names[idx + 1] = sq->name;
+    }
+
+    for (i = (priv->num_queues + nxdp) * 2; i < npairs * 2; i++)
+        names[i] = "unused";
+
+    /* Asynchronous ctrl commands complete from the ctrl vq interrupt */
+    if (priv->has_cvq) {
+        names[nvqs - 1] = "control";
+        callbacks[nvqs - 1] = virtio_nic_ctrl_callback;
+    }
+
+    err = virtio_find_vqs_ctx(priv->vdev, nvqs, vqs, callbacks, names, ctx, NULL);
+out:
+    kfree(ctx);
+    kfree(names);
+    kfree(callbacks);
+    return err;
+}
+
+/* Pick up the XDP TX rings found after the data queue pairs */
+static void virtio_nic_init_xdp_sqs(struct virtio_nic_priv *priv, struct virtqueue **vqs)
+{
+    int i;
+
+    for (i = 0; i < priv->num_xdp_sqs; i++) {
+        struct virtio_nic_xdp_sq *sq = &priv->xdp_sqs[i];
+
+        sq->priv = priv;
+        sq->vq = vqs[(priv->num_queues + i) * 2 + 1];
+        sq->unkicked = 0;
+        spin_lock_init(&sq->lock);
+    }
+}
 
 /* NUMA-aware queue setup */
 int virtio_nic_setup_queues(struct virtio_nic_priv *priv)
 {
-    struct virtqueue *vqs[VIRTIO_NIC_MAX_QUEUES];
-    static const char * const names[] = { "rx", "tx" };
+    struct virtqueue **vqs;
+    unsigned int nxdp;
     int i, err, numa_nodes = num_possible_nodes();
-    int queues_per_numa;
 
     if (!priv || !priv->vdev)
         return -EINVAL;
@@ -37,34 +256,79 @@ int virtio_nic_setup_queues(struct virtio_nic_priv *priv)
     if (!priv->queues)
         return -ENOMEM;
 
-    /* Setup virtqueues */
-    err = virtio_find_vqs(priv->vdev, priv->num_queues, vqs, NULL, names, NULL);
-    if (err) {
-        kfree(priv->queues);
-        return err;
+    /* One XDP TX ring per CPU unless capped by the parameter */
+    nxdp = xdp_tx_queues < 0 ? nr_cpu_ids : xdp_tx_queues;
+    nxdp = min_t(unsigned int, nxdp, VIRTIO_NIC_MAX_QUEUES);
+    if (priv->has_mq)
+        nxdp = min(nxdp, priv->max_queue_pairs - priv->num_queues);
+    if (nxdp) {
+        priv->xdp_sqs = kcalloc(nxdp, sizeof(*priv->xdp_sqs), GFP_KERNEL);
+        if (!priv->xdp_sqs)
+            nxdp = 0;
+    }
+
+    /* Data pairs rx0, tx0, rx1, tx1, ... then the XDP pairs */
+    vqs = kcalloc(virtio_nic_total_pairs(priv, nxdp) * 2 + 1, sizeof(*vqs), GFP_KERNEL);
+    if (!vqs) {
+        err = -ENOMEM;
+        goto free_arrays;
+    }
+
+    /* Setup virtqueues, dropping the XDP rings if the device lacks them */
+    err = virtio_nic_find_vqs(priv, nxdp, vqs);
+    if (err && nxdp) {
+        dev_info(&priv->vdev->dev,
+                 "no room for %u XDP TX queues, XDP_TX disabled\n", nxdp);
+        nxdp = 0;
+        err = virtio_nic_find_vqs(priv, 0, vqs);
+    }
+    if (err)
+        goto free_arrays;
+
+    if (!nxdp) {
+        kfree(priv->xdp_sqs);
+        priv->xdp_sqs = NULL;
     }
+    priv->num_xdp_sqs = nxdp;
+    virtio_nic_init_xdp_sqs(priv, vqs);
+    if (priv->has_cvq)
+        priv->ctrl_vq = vqs[virtio_nic_total_pairs(priv, nxdp) * 2];
 
     /* Initialize queues with NUMA awareness */
-    queues_per_numa = priv->num_queues / numa_nodes;
     for (i = 0; i < priv->num_queues; i++) {
         struct virtio_nic_queue *q = &priv->queues[i];
-        int numa_node = i / queues_per_numa;
+        /* Spread evenly; fewer queues than nodes leaves some nodes without */
+        int numa_node = i * numa_nodes / priv->num_queues;
 
-        q->vq = vqs[i];
+        q->priv = priv;
+        q->rx_vq = vqs[i * 2];
+        q->tx_vq = vqs[i * 2 + 1];
         q->numa_node = numa_node;
         q->cpu_id = -1; /* Will be assigned during NUMA setup */
         q->flow_tag = i;
         q->irq = -1;
 
         /* Initialize statistics */
-        q->rx_bytes = 0;
-        q->tx_bytes = 0;
-        q->rx_packets = 0;
-        q->tx_packets = 0;
+        u64_stats_init(&q->rx_stats.syncp);
+        u64_stats_init(&q->tx_stats.syncp);
         q->rx_errors = 0;
         q->tx_errors = 0;
-        q->rx_dropped = 0;
-        q->tx_dropped = 0;
+        q->tx_unkicked = 0;
+        q->tx_kicks = 0;
+        q->tx_kick_packets = 0;
+        q->tx_descs = 0;
+        q->tx_stops = 0;
+        /*
+         * With indirect tables the core puts each packet in one ring slot
+         * however many fragments it has.  It falls back to one descriptor
+         * per entry only if the table allocation fails, which costs us a
+         * drop, not a stall.
+         */
+        q->tx_desc_reserve = virtio_has_feature(priv->vdev, VIRTIO_RING_F_INDIRECT_DESC) ?
+                             1 : VIRTIO_NIC_TX_MAX_SG;
+        q->tx_completed = 0;
+        q->tx_reclaim_ns = 0;
+        q->tx_in_order = virtio_has_feature(priv->vdev, VIRTIO_F_IN_ORDER);
 
         /* Initialize locks and lists */
         spin_lock_init(&q->lock);
@@ -75,6 +339,21 @@ int virtio_nic_setup_queues(struct virtio_nic_priv *priv)
         /* Setup NAPI */
         netif_napi_add(priv->netdev, &q->napi, virtio_nic_poll, queue_weight);
 
+        /* Setup TX completion slots */
+        err = virtio_nic_alloc_tx_slots(q);
+        if (err) {
+            netif_napi_del(&q->napi);
+            goto free_slots;
+        }
+
+        /* Setup the RX page_pool on the queue's node */
+        err = virtio_nic_rx_init_queue(q);
+        if (err) {
+            virtio_nic_free_tx_slots(q);
+            netif_napi_del(&q->napi);
+            goto free_slots;
+        }
+
         /* Setup coalescing timer */
         setup_timer(&q->coalesce_timer, virtio_nic_coalesce_timer, (unsigned long)q);
 
@@ -82,11 +361,34 @@ int virtio_nic_setup_queues(struct virtio_nic_priv *priv)
         INIT_WORK(&q->failover_work, virtio_nic_failover_work);
     }
 
+    kfree(vqs);
+
     priv->active_queues = priv->num_queues;
     return 0;
+
+free_slots:
+    while (--i >= 0) {
+        virtio_nic_rx_cleanup_queue(&priv->queues[i]);
+        virtio_nic_free_tx_slots(&priv->queues[i]);
+        netif_napi_del(&priv->queues[i].napi);
+    }
+    priv->vdev->config->del_vqs(priv->vdev);
+free_arrays:
+    kfree(vqs);
+    kfree(priv->xdp_sqs);
+    priv->xdp_sqs = NULL;
+    priv->num_xdp_sqs = 0;
+    kfree(priv->queues);
+    priv->queues = NULL;
+    return err;
 }
 EXPORT_SYMBOL_GPL(virtio_nic_setup_queues);
 
+/*
+ * Free every queue and what is still posted to it.  The device must have
+ * been reset first: pages go back to the pool and the pool is destroyed
+ * here, so nothing may still be DMAing into them.
+ */
 void virtio_nic_teardown_queues(struct virtio_nic_priv *priv)
 {
     int i;
@@ -94,6 +396,12 @@ void virtio_nic_teardown_queues(struct virtio_nic_priv *priv)
     if (!priv || !priv->queues)
         return;
 
+    WARN_ON_ONCE(priv->vdev->config->get_status(priv->vdev) & VIRTIO_CONFIG_S_DRIVER_OK);
+
+    /* XDP_TX frames may hold RX pool pages, so return them first */
+    for (i = 0; i < priv->num_xdp_sqs; i++)
+        virtio_nic_xdp_free_unused(&priv->xdp_sqs[i]);
+
     for (i = 0; i < priv->num_queues; i++) {
         struct virtio_nic_queue *q = &priv->queues[i];
 
@@ -101,6 +409,13 @@ void virtio_nic_teardown_queues(struct virtio_nic_priv *priv)
         del_timer_sync(&q->coalesce_timer);
         cancel_work_sync(&q->failover_work);
 
+        /* Release in-flight TX packets */
+        virtio_nic_tx_free_unused(q);
+        virtio_nic_free_tx_slots(q);
+
+        /* Return posted RX buffers to the pool before destroying it */
+        virtio_nic_rx_cleanup_queue(q);
+
         /* Cleanup NAPI */
         netif_napi_del(&q->napi);
 
@@ -108,7 +423,12 @@ void virtio_nic_teardown_queues(struct virtio_nic_priv *priv)
         virtio_nic_cleanup_flow_list(q);
     }
 
+    virtio_nic_ctrl_free_unused(priv);
     priv->vdev->config->del_vqs(priv->vdev);
+    priv->ctrl_vq = NULL;
+    kfree(priv->xdp_sqs);
+    priv->xdp_sqs = NULL;
+    priv->num_xdp_sqs = 0;
     kfree(priv->queues);
     priv->queues = NULL;
     priv->num_queues = 0;
@@ -116,58 +436,507 @@ void virtio_nic_teardown_queues(struct virtio_nic_priv *priv)
 }
 EXPORT_SYMBOL_GPL(virtio_nic_teardown_queues);
 
-/* Enhanced enqueue with flow tracking */
+/* Point the device at the active pairs, re-spreading a default RSS table */
+static int virtio_nic_steer_queues(struct virtio_nic_priv *priv)
+{
+    u32 old_indir[VIRTIO_NIC_RSS_MAX_TABLE];
+    int i, err;
+
+    if (!priv->has_rss)
+        return virtio_nic_set_queue_pairs(priv, priv->active_queues);
+
+    /* ethtool has already checked a user table against the new count */
+    if (netif_is_rxfh_configured(priv->netdev))
+        return virtio_nic_rss_commit(priv);
+
+    memcpy(old_indir, priv->rss_indir, sizeof(old_indir));
+    for (i = 0; i < priv->rss_table_size; i++)
+        priv->rss_indir[i] = ethtool_rxfh_indir_default(i, priv->active_queues);
+
+    err = virtio_nic_rss_commit(priv);
+    if (err)
+        memcpy(priv->rss_indir, old_indir, sizeof(old_indir));
+    return err;
+}
+
+/*
+ * Change how many queue pairs are in use without a reset (ethtool -L).
+ * Pairs past the new count keep their rings, so growing back is cheap.
+ * Growing brings the queues up before the device is told about them;
+ * shrinking steers the device away first, lets each queue's NAPI run
+ * once more for what already arrived and waits for its TX ring to drain.
+ * Called under RTNL.
+ */
+int virtio_nic_set_active_queues(struct virtio_nic_priv *priv, unsigned int n)
+{
+    struct net_device *ndev = priv->netdev;
+    unsigned int old = priv->active_queues;
+    bool running = netif_running(ndev);
+    u64 start_ns = ktime_get_ns();
+    unsigned int i;
+    int err;
+
+    if (n == old)
+        return 0;
+
+    /* The refill worker walks the active queues toggling NAPI */
+    if (running)
+        cancel_delayed_work_sync(&priv->refill_work);
+
+    if (n > old) {
+        for (i = old; running && i < n; i++) {
+            virtio_nic_rx_refill(&priv->queues[i], GFP_KERNEL);
+            napi_enable(&priv->queues[i].napi);
+        }
+
+        err = netif_set_real_num_tx_queues(ndev, n);
+        if (!err)
+            err = netif_set_real_num_rx_queues(ndev, n);
+        if (!err) {
+            priv->active_queues = n;
+            err = virtio_nic_steer_queues(priv);
+        }
+        if (err) {
+            priv->active_queues = old;
+            netif_set_real_num_tx_queues(ndev, old);
+            netif_set_real_num_rx_queues(ndev, old);
+            for (i = old; running && i < n; i++)
+                napi_disable(&priv->queues[i].napi);
+            if (running)
+                schedule_delayed_work(&priv->refill_work, 0);
+            return err;
+        }
+
+        /* Pick up anything the device delivered before NAPI was ours */
+        for (i = old; running && i < n; i++)
+            napi_schedule(&priv->queues[i].napi);
+    } else {
+        priv->active_queues = n;
+        err = virtio_nic_steer_queues(priv);
+        if (err) {
+            priv->active_queues = old;
+            if (running)
+                schedule_delayed_work(&priv->refill_work, 0);
+            return err;
+        }
+
+        /* Shrinking can't fail; the stack stops picking the old TX queues */
+        netif_set_real_num_tx_queues(ndev, n);
+        netif_set_real_num_rx_queues(ndev, n);
+
+        /*
+         * A last poll delivers what was already received.  TX completions
+         * are drained before NAPI goes away: an skb left on the ring would
+         * hold its socket's wmem and the queue's BQL charge, stalling
+         * TSQ-limited senders until the pair is used again.
+         */
+        for (i = n; running && i < old; i++) {
+            struct virtio_nic_queue *q = &priv->queues[i];
+            unsigned long timeout = jiffies + HZ;
+
+            do {
+                napi_schedule(&q->napi);
+                if (!atomic_read(&q->pending_packets))
+                    break;
+                usleep_range(50, 100);
+            } while (time_before(jiffies, timeout));
+
+            napi_disable(&q->napi);
+            /* NAPI is ours now; pick up whatever completed after its last run */
+            virtio_nic_tx_reclaim(q, 0);
+            if (atomic_read(&q->pending_packets))
+                netdev_warn(ndev, "queue %u: %d TX packets still in flight\n",
+                            i, atomic_read(&q->pending_packets));
+            virtqueue_disable_cb(q->rx_vq);
+            virtqueue_disable_cb(q->tx_vq);
+        }
+    }
+
+    virtio_nic_set_affinity(priv);
+
+    /* Top up every live ring, standing in for the worker cancelled above */
+    if (running)
+        schedule_delayed_work(&priv->refill_work, 0);
+
+    /* New pairs start without the per-queue coalescing the others have */
+    if (n > old && priv->has_vq_notf_coal &&
+        (priv->coal_rx_usecs || priv->coal_rx_frames ||
+         priv->coal_tx_usecs || priv->coal_tx_frames))
+        virtio_nic_set_notf_coal(priv, priv->coal_rx_usecs, priv->coal_rx_frames,
+                                 priv->coal_tx_usecs, priv->coal_tx_frames);
+
+    WRITE_ONCE(priv->channel_change_ns, ktime_get_ns() - start_ns);
+    WRITE_ONCE(priv->channel_changes, priv->channel_changes + 1);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_set_active_queues);
+
+/*
+ * Resize one pair's rings in place.  virtqueue_resize() takes each ring
+ * back from the device, hands every posted buffer to the recycle callback
+ * and re-enables it at the new size; the TX slot tables follow.  If the
+ * device keeps the old size the old tables stay, all slots free again.
+ */
+static int virtio_nic_resize_queue(struct virtio_nic_queue *q, u32 rx_size, u32 tx_size,
+                                   bool live)
+{
+    struct netdev_queue *txq = virtio_nic_txq(q);
+    struct virtio_nic_tx_slot *slots = NULL;
+    u16 *free = NULL;
+    u8 *slab = NULL;
+    int err = 0;
+
+    if (tx_size != q->tx_ring_size) {
+        err = virtio_nic_tx_slots_alloc(q, tx_size, &slots, &free, &slab);
+        if (err)
+            return err;
+    }
+
+    /* Ring resize sleeps, so quiesce the queue rather than hold its locks */
+    if (live) {
+        napi_disable(&q->napi);
+        __netif_tx_lock_bh(txq);
+        netif_tx_stop_queue(txq);
+        __netif_tx_unlock_bh(txq);
+    }
+
+    if (rx_size != q->rx_ring_size) {
+        err = virtqueue_resize(q->rx_vq, rx_size, virtio_nic_rx_recycle);
+        q->rx_ring_size = virtqueue_get_vring_size(q->rx_vq);
+        if (!err && q->rx_ring_size != rx_size)
+            err = -ENOMEM;
+    }
+
+    if (!err && slots) {
+        err = virtqueue_resize(q->tx_vq, tx_size, virtio_nic_tx_recycle);
+        netdev_tx_reset_queue(txq);
+        q->tx_unkicked = 0;
+
+        if (virtqueue_get_vring_size(q->tx_vq) == tx_size) {
+            virtio_nic_free_tx_slots(q);
+            virtio_nic_tx_slots_install(q, tx_size, slots, free, slab);
+            slots = NULL;
+            free = NULL;
+            slab = NULL;
+        } else if (!err) {
+            err = -ENOMEM;
+        }
+    }
+
+    kfree(slab);
+    kfree(free);
+    kfree(slots);
+
+    if (live) {
+        virtio_nic_rx_refill(q, GFP_KERNEL);
+        netif_tx_wake_queue(txq);
+        napi_enable(&q->napi);
+        napi_schedule(&q->napi);
+    }
+
+    return err;
+}
+
+/*
+ * ethtool -G: resize every pair, inactive ones too so a later ethtool -L
+ * brings them up at the same depth.  Needs VIRTIO_F_RING_RESET; each pair
+ * is only offline for its own reset.  Called under RTNL.
+ */
+int virtio_nic_resize_rings(struct virtio_nic_priv *priv, u32 rx_size, u32 tx_size)
+{
+    bool running = netif_running(priv->netdev);
+    struct virtio_nic_queue_mem mem;
+    int i, err = 0;
+
+    /* The refill worker toggles NAPI on the queues we are about to quiesce */
+    if (running)
+        cancel_delayed_work_sync(&priv->refill_work);
+
+    for (i = 0; i < priv->num_queues && !err; i++)
+        err = virtio_nic_resize_queue(&priv->queues[i], rx_size, tx_size,
+                                      running && i < priv->active_queues);
+
+    if (running)
+        schedule_delayed_work(&priv->refill_work, 0);
+
+    if (err) {
+        netdev_warn(priv->netdev, "ring resize stopped at queue %d: %d\n", i - 1, err);
+        return err;
+    }
+
+    virtio_nic_get_queue_mem(&priv->queues[0], &mem);
+    netdev_info(priv->netdev, "rings resized to rx %u tx %u: %llu KiB per queue pair\n",
+                priv->queues[0].rx_ring_size, priv->queues[0].tx_ring_size,
+                (mem.rx_vring_bytes + mem.tx_vring_bytes + mem.rx_buf_bytes +
+                 mem.tx_slot_bytes) >> 10);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_resize_rings);
+
+/* Called with q->lock held; returns true if the device needs a notify */
+static bool __virtio_nic_tx_kick_prepare(struct virtio_nic_queue *q)
+{
+    bool notify = false;
+
+    if (!q->tx_unkicked)
+        return false;
+
+    if (virtqueue_kick_prepare(q->tx_vq)) {
+        notify = true;
+        q->tx_kicks++;
+    }
+    q->tx_kick_packets += q->tx_unkicked;
+    q->tx_unkicked = 0;
+
+    return notify;
+}
+
+/*
+ * Enhanced enqueue with flow tracking and doorbell batching.  @data is the
+ * TX slot that owns the packet; it comes back from the device as the token.
+ */
 int virtio_nic_enqueue(struct virtio_nic_queue *q, struct scatterlist *sg,
-                       unsigned int out, unsigned int in, void *data)
+                       unsigned int out, unsigned int in, void *data, bool kick)
 {
     unsigned long flags;
     int err;
-    struct sk_buff *skb = (struct sk_buff *)data;
+    struct virtio_nic_tx_slot *slot = data;
+    struct sk_buff *skb = slot ? slot->skb : NULL;
+    struct scatterlist *sgs[] = { sg };  /* one terminated sg table */
     u32 flow_id;
+    unsigned int num_free;
+    bool notify = false;
 
-    if (!q || !sg)
+    if (!q || !sg || out + in != 1)
         return -EINVAL;
 
     /* Extract flow ID for tracking */
     flow_id = skb ? (skb->hash % 0xFFFF) : 0;
 
     spin_lock_irqsave(&q->lock, flags);
-    
-    err = virtqueue_add_sgs(q->vq, sg, out, in, data, GFP_ATOMIC);
+
+    num_free = q->tx_vq->num_free;
+    err = virtqueue_add_sgs(q->tx_vq, sgs, out, in, data, GFP_ATOMIC);
     if (!err) {
-        virtqueue_kick(q->vq);
+        q->tx_descs += num_free - q->tx_vq->num_free;
+        q->tx_unkicked++;
         atomic_inc(&q->pending_packets);
         
         /* Update flow tracking */
         virtio_nic_update_flow_stats(q, flow_id, skb ? skb->len : 0);
     }
 
+    /*
+     * Ring the doorbell only at the end of a burst.  A failed add must
+     * still flush whatever earlier xmit_more packets are sitting unkicked.
+     */
+    if (kick || err)
+        notify = __virtio_nic_tx_kick_prepare(q);
+
     spin_unlock_irqrestore(&q->lock, flags);
+
+    /* The notify is the VM exit; keep it outside the queue lock */
+    if (notify)
+        virtqueue_notify(q->tx_vq);
+
     return err;
 }
 EXPORT_SYMBOL_GPL(virtio_nic_enqueue);
 
-/* Enhanced dequeue with statistics */
-void *virtio_nic_dequeue(struct virtio_nic_queue *q, unsigned int *len)
+/* Flush packets queued without a doorbell */
+void virtio_nic_tx_kick(struct virtio_nic_queue *q)
 {
     unsigned long flags;
+    bool notify;
+
+    spin_lock_irqsave(&q->lock, flags);
+    notify = __virtio_nic_tx_kick_prepare(q);
+    spin_unlock_irqrestore(&q->lock, flags);
+
+    if (notify)
+        virtqueue_notify(q->tx_vq);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_tx_kick);
+
+/*
+ * Enhanced dequeue with statistics.  The RX ring is only touched from NAPI
+ * (or with NAPI disabled), so unlike TX it needs no queue lock.
+ */
+void *virtio_nic_dequeue(struct virtio_nic_queue *q, unsigned int *len, void **ctx)
+{
     void *buf;
 
     if (!q || !len)
         return NULL;
 
-    spin_lock_irqsave(&q->lock, flags);
-    buf = virtqueue_get_buf(q->vq, len);
-    if (buf) {
-        atomic_dec(&q->pending_packets);
+    buf = virtqueue_get_buf_ctx(q->rx_vq, len, ctx);
+    if (buf)
         telemetry_record_rx();
-    }
-    spin_unlock_irqrestore(&q->lock, flags);
 
     return buf;
 }
 EXPORT_SYMBOL_GPL(virtio_nic_dequeue);
 
+/* Take a free TX slot, or NULL when every ring entry is in flight */
+struct virtio_nic_tx_slot *virtio_nic_tx_slot_get(struct virtio_nic_queue *q)
+{
+    struct virtio_nic_tx_slot *slot = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&q->lock, flags);
+    if (q->tx_in_order) {
+        /* The oldest slot is always the next to come back */
+        if (q->tx_inflight < q->tx_ring_size) {
+            slot = &q->tx_slots[q->tx_head];
+            q->tx_head = q->tx_head + 1 == q->tx_ring_size ? 0 : q->tx_head + 1;
+            q->tx_inflight++;
+        }
+    } else if (q->tx_free_top) {
+        slot = &q->tx_slots[q->tx_free[--q->tx_free_top]];
+    }
+    spin_unlock_irqrestore(&q->lock, flags);
+
+    return slot;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_tx_slot_get);
+
+static void virtio_nic_tx_slot_clear(struct virtio_nic_tx_slot *slot)
+{
+    slot->skb = NULL;
+    slot->nents = 0;
+    slot->xsk = false;
+    slot->copied = false;
+}
+
+static void __virtio_nic_tx_slot_put(struct virtio_nic_queue *q,
+                                     struct virtio_nic_tx_slot *slot)
+{
+    unsigned int newest;
+
+    virtio_nic_tx_slot_clear(slot);
+
+    if (!q->tx_in_order) {
+        q->tx_free[q->tx_free_top++] = slot - q->tx_slots;
+        return;
+    }
+
+    /*
+     * A slot that was never sent is always the newest, so hand it out
+     * again; otherwise one slot has retired.  Either way one fewer is
+     * in flight, which also holds for the unordered detach on reset.
+     */
+    newest = q->tx_head ? q->tx_head - 1 : q->tx_ring_size - 1;
+    if (slot == &q->tx_slots[newest])
+        q->tx_head = newest;
+    q->tx_inflight--;
+}
+
+void virtio_nic_tx_slot_put(struct virtio_nic_queue *q, struct virtio_nic_tx_slot *slot)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&q->lock, flags);
+    __virtio_nic_tx_slot_put(q, slot);
+    spin_unlock_irqrestore(&q->lock, flags);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_tx_slot_put);
+
+/* True when a worst-case skb still fits in the TX ring */
+bool virtio_nic_tx_has_room(struct virtio_nic_queue *q)
+{
+    bool slot_free = q->tx_in_order ?
+                     READ_ONCE(q->tx_inflight) < q->tx_ring_size :
+                     READ_ONCE(q->tx_free_top);
+
+    return slot_free && q->tx_vq->num_free >= q->tx_desc_reserve;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_tx_has_room);
+
+/*
+ * Reclaim up to @budget completed TX packets: free the skbs and return
+ * the slots.  Completions are pulled off the used ring in batches so the
+ * queue lock is taken twice per batch rather than per packet.  In
+ * in-order mode a batch is always the oldest run of slots, so returning
+ * it is a single counter update.  A @budget of 0 means we are not in NAPI
+ * context.
+ */
+int virtio_nic_tx_reclaim(struct virtio_nic_queue *q, int budget)
+{
+    struct virtio_nic_tx_slot *done[VIRTIO_NIC_TX_RECLAIM_BATCH];
+    struct netdev_queue *txq = virtio_nic_txq(q);
+    int limit = budget ? budget : q->tx_ring_size;
+    int reclaimed = 0;
+    int xsk_done = 0;
+    unsigned int bytes = 0;
+    unsigned long flags;
+    unsigned int len;
+    u64 start_ns, now;
+    int n, i;
+
+    start_ns = ktime_get_ns();
+
+    while (reclaimed < limit) {
+        spin_lock_irqsave(&q->lock, flags);
+        for (n = 0; n < VIRTIO_NIC_TX_RECLAIM_BATCH && reclaimed + n < limit; n++) {
+            done[n] = virtqueue_get_buf(q->tx_vq, &len);
+            if (!done[n])
+                break;
+        }
+        spin_unlock_irqrestore(&q->lock, flags);
+
+        if (!n)
+            break;
+
+        for (i = 0; i < n; i++) {
+            if (unlikely(done[i]->xsk)) {
+                xsk_done++;
+            } else if (done[i]->copied) {
+                bytes += done[i]->len;
+            } else {
+                bytes += done[i]->skb->len;
+                napi_consume_skb(done[i]->skb, budget);
+            }
+            if (q->tx_in_order)
+                virtio_nic_tx_slot_clear(done[i]);
+        }
+
+        spin_lock_irqsave(&q->lock, flags);
+        if (q->tx_in_order) {
+            q->tx_inflight -= n;
+        } else {
+            for (i = 0; i < n; i++)
+                __virtio_nic_tx_slot_put(q, done[i]);
+        }
+        now = ktime_get_ns();
+        q->tx_completed += n;
+        q->tx_reclaim_ns += now - start_ns;
+        spin_unlock_irqrestore(&q->lock, flags);
+        start_ns = now;
+
+        atomic_sub(n, &q->pending_packets);
+        reclaimed += n;
+
+        if (n < VIRTIO_NIC_TX_RECLAIM_BATCH)
+            break;
+    }
+
+    if (!reclaimed)
+        return 0;
+
+    /* AF_XDP frames complete to the socket's completion ring in order */
+    if (xsk_done && q->xsk_pool)
+        xsk_tx_completed(q->xsk_pool, xsk_done);
+
+    /* Byte Queue Limits: credit the completed bytes back to this subqueue */
+    netdev_tx_completed_queue(txq, reclaimed - xsk_done, bytes);
+
+    if (netif_tx_queue_stopped(txq) && virtio_nic_tx_has_room(q))
+        netif_tx_wake_queue(txq);
+
+    return reclaimed;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_tx_reclaim);
+
 /* Assign queue to specific CPU for NUMA optimization */
 int virtio_nic_assign_queue_to_cpu(struct virtio_nic_queue *q, int cpu)
 {
@@ -224,18 +993,86 @@ void virtio_nic_coalesce_timer(unsigned long data)
     }
 }
 
-/* Failover work function */
+/*
+ * Reset one queue pair with VIRTIO_F_RING_RESET while the others keep
+ * running: quiesce its NAPI and TX subqueue, take both rings back from the
+ * device (every posted buffer goes through the recycle callbacks), then
+ * re-enable, refill and resume.  Called under RTNL.
+ */
+int virtio_nic_reset_queue(struct virtio_nic_queue *q)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    struct netdev_queue *txq = virtio_nic_txq(q);
+    bool live = netif_running(priv->netdev) && q - priv->queues < priv->active_queues;
+    u64 start_ns, ns;
+    int err;
+
+    if (!virtio_has_feature(priv->vdev, VIRTIO_F_RING_RESET))
+        return -EOPNOTSUPP;
+
+    start_ns = ktime_get_ns();
+
+    if (live) {
+        napi_disable(&q->napi);
+        __netif_tx_lock_bh(txq);
+        netif_tx_stop_queue(txq);
+        __netif_tx_unlock_bh(txq);
+    }
+
+    err = virtqueue_reset(q->rx_vq, virtio_nic_rx_recycle);
+    if (!err)
+        err = virtqueue_reset(q->tx_vq, virtio_nic_tx_recycle);
+    netdev_tx_reset_queue(txq);
+    q->tx_unkicked = 0;
+
+    if (live) {
+        if (!virtio_nic_rx_refill(q, GFP_KERNEL))
+            schedule_delayed_work(&priv->refill_work, 0);
+        netif_tx_wake_queue(txq);
+        napi_enable(&q->napi);
+        napi_schedule(&q->napi);
+    }
+
+    if (err) {
+        WRITE_ONCE(q->reset_failed, q->reset_failed + 1);
+        return err;
+    }
+
+    ns = ktime_get_ns() - start_ns;
+    WRITE_ONCE(q->reset_ns, ns);
+    WRITE_ONCE(q->reset_ns_max, max(q->reset_ns_max, ns));
+    WRITE_ONCE(q->resets, q->resets + 1);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_reset_queue);
+
+/*
+ * Recover a failed or timed-out queue.  A ring reset brings the queue
+ * itself back; without one, its flows move to the healthiest active queue.
+ */
 void virtio_nic_failover_work(struct work_struct *work)
 {
     struct virtio_nic_queue *q = container_of(work, struct virtio_nic_queue, failover_work);
-    struct virtio_nic_priv *priv = netdev_priv(q->vq->vdev->priv);
-    
-    /* Implement queue failover logic */
-    if (q->rx_errors > 1000 || q->tx_errors > 1000) {
-        /* Mark queue as failed and reassign flows */
-        dev_warn(&priv->vdev->dev, "Queue %d failed, reassigning flows\n", q->flow_tag);
-        virtio_nic_remap_queue(priv, q->flow_tag, (q->flow_tag + 1) % priv->num_queues);
+    struct virtio_nic_priv *priv = q->priv;
+    int qid = q - priv->queues;
+    int err;
+
+    rtnl_lock();
+    err = virtio_nic_reset_queue(q);
+    rtnl_unlock();
+
+    if (!err) {
+        q->rx_errors = 0;
+        q->tx_errors = 0;
+        virtio_nic_queue_recovered(priv, qid);
+        dev_info(&priv->vdev->dev, "Queue %d reset in %llu us\n",
+                 qid, div_u64(q->reset_ns, NSEC_PER_USEC));
+        return;
     }
+
+    dev_warn(&priv->vdev->dev, "Queue %d reset failed (%d), reassigning flows\n", qid, err);
+    if (virtio_nic_remap_queue(priv, qid, -1))
+        dev_err(&priv->vdev->dev, "Queue %d: no healthy queue to take its flows\n", qid);
 }
 
 /* Update flow statistics */
@@ -290,13 +1127,36 @@ EXPORT_SYMBOL_GPL(virtio_nic_cleanup_flow_list);
 /* Get queue statistics */
 void virtio_nic_get_queue_stats(struct virtio_nic_queue *q, struct virtio_nic_queue_stats *stats)
 {
+    unsigned int start;
+
     if (!q || !stats)
         return;
 
-    stats->rx_bytes = q->rx_bytes;
-    stats->tx_bytes = q->tx_bytes;
-    stats->rx_packets = q->rx_packets;
-    stats->tx_packets = q->tx_packets;
+    do {
+        start = u64_stats_fetch_begin(&q->rx_stats.syncp);
+        stats->rx_packets = u64_stats_read(&q->rx_stats.packets);
+        stats->rx_bytes = u64_stats_read(&q->rx_stats.bytes);
+        stats->rx_dropped = u64_stats_read(&q->rx_stats.dropped);
+        stats->rx_hashed = u64_stats_read(&q->rx_stats.hashed);
+        stats->rx_csum_offload = u64_stats_read(&q->rx_stats.csum_offload);
+        stats->rx_csum_sw = u64_stats_read(&q->rx_stats.csum_sw);
+        stats->rx_copybreak = u64_stats_read(&q->rx_stats.copybreak);
+        stats->xdp_packets = u64_stats_read(&q->rx_stats.xdp_packets);
+        stats->xdp_drops = u64_stats_read(&q->rx_stats.xdp_drops);
+        stats->xdp_tx = u64_stats_read(&q->rx_stats.xdp_tx);
+        stats->xdp_redirects = u64_stats_read(&q->rx_stats.xdp_redirects);
+    } while (u64_stats_fetch_retry(&q->rx_stats.syncp, start));
+
+    do {
+        start = u64_stats_fetch_begin(&q->tx_stats.syncp);
+        stats->tx_packets = u64_stats_read(&q->tx_stats.packets);
+        stats->tx_bytes = u64_stats_read(&q->tx_stats.bytes);
+        stats->tx_dropped = u64_stats_read(&q->tx_stats.dropped);
+        stats->tx_csum_offload = u64_stats_read(&q->tx_stats.csum_offload);
+        stats->tx_csum_sw = u64_stats_read(&q->tx_stats.csum_sw);
+        stats->tx_copybreak = u64_stats_read(&q->tx_stats.copybreak);
+    } while (u64_stats_fetch_retry(&q->tx_stats.syncp, start));
+
     stats->rx_errors = q->rx_errors;
     stats->tx_errors = q->tx_errors;
     stats->pending_packets = atomic_read(&q->pending_packets);
@@ -305,6 +1165,32 @@ void virtio_nic_get_queue_stats(struct virtio_nic_queue *q, struct virtio_nic_qu
 }
 EXPORT_SYMBOL_GPL(virtio_nic_get_queue_stats);
 
+/* Bytes the device's view of a ring takes, descriptors plus index rings */
+static u64 virtio_nic_vring_bytes(struct virtio_nic_queue *q, struct virtqueue *vq)
+{
+    unsigned int num = virtqueue_get_vring_size(vq);
+
+    if (virtio_has_feature(q->priv->vdev, VIRTIO_F_RING_PACKED))
+        return (u64)num * sizeof(struct vring_packed_desc) +
+               2 * sizeof(struct vring_packed_desc_event);
+
+    return vring_size(num, SMP_CACHE_BYTES);
+}
+
+/* Memory a queue pair holds at its current ring sizes, for ethtool -G sizing */
+void virtio_nic_get_queue_mem(struct virtio_nic_queue *q, struct virtio_nic_queue_mem *mem)
+{
+    unsigned int buf_len = q->priv->mergeable_rx_bufs ? virtio_nic_rx_mrg_len(q) :
+                                                        q->rx_truesize;
+
+    mem->rx_vring_bytes = virtio_nic_vring_bytes(q, q->rx_vq);
+    mem->tx_vring_bytes = virtio_nic_vring_bytes(q, q->tx_vq);
+    mem->rx_buf_bytes = (u64)q->rx_ring_size * buf_len;
+    mem->tx_slot_bytes = (u64)q->tx_ring_size *
+                         (sizeof(*q->tx_slots) + sizeof(*q->tx_free) + q->tx_copybreak);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_get_queue_mem);
+
 /* Module initialization */
 static int __init virtio_nic_queue_init(void)
 {
@@ -0,0 +1,251 @@
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/ethtool.h>
+#include <linux/scatterlist.h>
+#include <linux/virtio_config.h>
+#include <net/flow_dissector.h>
+#include <asm/unaligned.h>
+#include "virtio_nic.h"
+
+/* Per-bucket accounting re-hashes every packet in software, so it is opt-in */
+static bool rss_bucket_stats;
+
+module_param(rss_bucket_stats, bool, 0644);
+
+MODULE_PARM_DESC(rss_bucket_stats, "Count RX packets per RSS indirection bucket");
+
+/* Read the device's RSS and hash report limits; called before queues are set up */
+void virtio_nic_rss_probe(struct virtio_nic_priv *priv)
+{
+    struct virtio_device *vdev = priv->vdev;
+    u16 table_len = 0;
+    u8 key_len;
+
+    priv->has_rss = priv->has_cvq && virtio_has_feature(vdev, VIRTIO_NET_F_RSS);
+    if (!priv->has_rss && !priv->has_hash_report)
+        return;
+
+    key_len = virtio_cread8(vdev, offsetof(struct virtio_net_config, rss_max_key_size));
+    if (priv->has_rss)
+        table_len = virtio_cread16(vdev, offsetof(struct virtio_net_config,
+                                                  rss_max_indirection_table_length));
+    priv->rss_hash_types = virtio_cread32(vdev, offsetof(struct virtio_net_config,
+                                                         supported_hash_types)) &
+                           VIRTIO_NIC_RSS_HASH_TYPES;
+
+    /* The indirection mask requires a power-of-two table */
+    priv->rss_key_size = min_t(u8, key_len, VIRTIO_NIC_RSS_MAX_KEY);
+    priv->rss_table_size = table_len ?
+        rounddown_pow_of_two(min_t(u16, table_len, VIRTIO_NIC_RSS_MAX_TABLE)) : 0;
+
+    if (!priv->rss_key_size || !priv->rss_hash_types) {
+        priv->has_rss = false;
+        priv->has_hash_report = false;
+    }
+    if (!priv->rss_table_size)
+        priv->has_rss = false;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rss_probe);
+
+/*
+ * Program priv's table and key into the device.  Without RSS only the hash
+ * report is configured: HASH_CONFIG shares the RSS layout with the queue
+ * fields reserved, which a one-entry zeroed table reproduces exactly.
+ */
+int virtio_nic_rss_commit(struct virtio_nic_priv *priv)
+{
+    struct virtio_nic_rss_cfg *cfg = priv->rss_cfg;
+    unsigned int table_size = priv->has_rss ? priv->rss_table_size : 1;
+    struct scatterlist sg[4];
+    int i;
+
+    cfg->hash_types = cpu_to_le32(priv->rss_hash_types);
+    cfg->indirection_table_mask = cpu_to_le16(priv->has_rss ? table_size - 1 : 0);
+    cfg->unclassified_queue = 0;
+    for (i = 0; i < table_size; i++)
+        cfg->indirection_table[i] = cpu_to_le16(priv->has_rss ? priv->rss_indir[i] : 0);
+    cfg->max_tx_vq = cpu_to_le16(priv->has_rss ?
+                                 virtio_nic_device_pairs(priv, priv->active_queues) : 0);
+    cfg->hash_key_length = priv->rss_key_size;
+    memcpy(cfg->key, priv->rss_key, priv->rss_key_size);
+
+    sg_init_table(sg, 4);
+    sg_set_buf(&sg[0], &cfg->hash_types,
+               offsetof(struct virtio_nic_rss_cfg, indirection_table));
+    sg_set_buf(&sg[1], cfg->indirection_table,
+               sizeof(cfg->indirection_table[0]) * table_size);
+    sg_set_buf(&sg[2], &cfg->max_tx_vq,
+               offsetof(struct virtio_nic_rss_cfg, key) -
+               offsetof(struct virtio_nic_rss_cfg, max_tx_vq));
+    sg_set_buf(&sg[3], cfg->key, priv->rss_key_size);
+
+    if (!virtio_nic_ctrl_cmd(priv, VIRTIO_NET_CTRL_MQ,
+                             priv->has_rss ? VIRTIO_NET_CTRL_MQ_RSS_CONFIG :
+                                             VIRTIO_NET_CTRL_MQ_HASH_CONFIG, sg)) {
+        dev_warn(&priv->vdev->dev, "failed to program %s configuration\n",
+                 priv->has_rss ? "RSS" : "hash report");
+        return -EIO;
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rss_commit);
+
+/* Spread buckets evenly over the active queues with a random key */
+int virtio_nic_rss_init(struct virtio_nic_priv *priv)
+{
+    int i;
+
+    if (!priv->has_rss && !priv->has_hash_report)
+        return 0;
+
+    priv->rss_cfg = kzalloc(sizeof(*priv->rss_cfg), GFP_KERNEL);
+    if (!priv->rss_cfg) {
+        priv->has_rss = false;
+        priv->has_hash_report = false;
+        return -ENOMEM;
+    }
+
+    if (!priv->has_rss) {
+        netdev_rss_key_fill(priv->rss_key, priv->rss_key_size);
+        return virtio_nic_rss_commit(priv);
+    }
+
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+
+        q->rss_bucket_hits = kcalloc_node(priv->rss_table_size,
+                                          sizeof(*q->rss_bucket_hits),
+                                          GFP_KERNEL, q->numa_node);
+    }
+
+    for (i = 0; i < priv->rss_table_size; i++)
+        priv->rss_indir[i] = ethtool_rxfh_indir_default(i, priv->active_queues);
+    netdev_rss_key_fill(priv->rss_key, priv->rss_key_size);
+
+    return virtio_nic_rss_commit(priv);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rss_init);
+
+void virtio_nic_rss_cleanup(struct virtio_nic_priv *priv)
+{
+    int i;
+
+    for (i = 0; priv->queues && i < priv->num_queues; i++) {
+        kfree(priv->queues[i].rss_bucket_hits);
+        priv->queues[i].rss_bucket_hits = NULL;
+    }
+
+    kfree(priv->rss_cfg);
+    priv->rss_cfg = NULL;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rss_cleanup);
+
+/* Toeplitz hash as the device computes it, over network-order input */
+static u32 virtio_nic_toeplitz(const u8 *key, unsigned int key_len,
+                               const u8 *data, unsigned int len)
+{
+    u32 v = get_unaligned_be32(key);
+    u32 hash = 0;
+    unsigned int i, b;
+
+    for (i = 0; i < len; i++) {
+        for (b = 0; b < 8; b++) {
+            if (data[i] & (0x80 >> b))
+                hash ^= v;
+            v <<= 1;
+            if (i + 4 < key_len && (key[i + 4] & (0x80 >> b)))
+                v |= 1;
+        }
+    }
+
+    return hash;
+}
+
+/* Device RSS hash for @skb under the programmed hash types; false if unhashed */
+static bool virtio_nic_rss_hash(struct virtio_nic_priv *priv, struct sk_buff *skb,
+                                u32 *hash)
+{
+    struct flow_keys keys;
+    u8 input[36];
+    unsigned int len = 0;
+    bool l4, tcp, udp;
+    u32 types = priv->rss_hash_types;
+
+    if (!skb_flow_dissect_flow_keys(skb, &keys, 0))
+        return false;
+
+    tcp = keys.basic.ip_proto == IPPROTO_TCP;
+    udp = keys.basic.ip_proto == IPPROTO_UDP;
+
+    switch (keys.control.addr_type) {
+    case FLOW_DISSECTOR_KEY_IPV4_ADDRS:
+        if (!(types & VIRTIO_NET_RSS_HASH_TYPE_IPv4))
+            return false;
+        memcpy(input, &keys.addrs.v4addrs.src, 4);
+        memcpy(input + 4, &keys.addrs.v4addrs.dst, 4);
+        len = 8;
+        l4 = (tcp && (types & VIRTIO_NET_RSS_HASH_TYPE_TCPv4)) ||
+             (udp && (types & VIRTIO_NET_RSS_HASH_TYPE_UDPv4));
+        break;
+    case FLOW_DISSECTOR_KEY_IPV6_ADDRS:
+        if (!(types & VIRTIO_NET_RSS_HASH_TYPE_IPv6))
+            return false;
+        memcpy(input, &keys.addrs.v6addrs.src, 16);
+        memcpy(input + 16, &keys.addrs.v6addrs.dst, 16);
+        len = 32;
+        l4 = (tcp && (types & VIRTIO_NET_RSS_HASH_TYPE_TCPv6)) ||
+             (udp && (types & VIRTIO_NET_RSS_HASH_TYPE_UDPv6));
+        break;
+    default:
+        return false;
+    }
+
+    if (l4 && !(keys.control.flags & FLOW_DIS_IS_FRAGMENT)) {
+        memcpy(input + len, &keys.ports.src, 2);
+        memcpy(input + len + 2, &keys.ports.dst, 2);
+        len += 4;
+    }
+
+    *hash = virtio_nic_toeplitz(priv->rss_key, priv->rss_key_size, input, len);
+    return true;
+}
+
+/*
+ * Account one received packet to its indirection bucket; unhashed ones are
+ * skipped.  A reported device hash is free, so only the software fallback
+ * is gated on rss_bucket_stats.
+ */
+void virtio_nic_rss_count(struct virtio_nic_queue *q, struct sk_buff *skb)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    u32 hash;
+
+    if (!q->rss_bucket_hits)
+        return;
+
+    if (skb->hash)
+        hash = skb->hash;
+    else if (!rss_bucket_stats || !virtio_nic_rss_hash(priv, skb, &hash))
+        return;
+
+    q->rss_bucket_hits[hash & (priv->rss_table_size - 1)]++;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rss_count);
+
+/* Module initialization */
+static int __init virtio_nic_rss_module_init(void)
+{
+    return 0;
+}
+
+static void __exit virtio_nic_rss_module_exit(void)
+{
+    /* Cleanup handled by main driver */
+}
+
+module_init(virtio_nic_rss_module_init);
+module_exit(virtio_nic_rss_module_exit);
+
+MODULE_DESCRIPTION("Receive Side Scaling for VirtIO NIC driver");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,763 @@
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/if_vlan.h>
+#include <linux/skbuff.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-mapping.h>
+#include <linux/workqueue.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/list.h>
+#include <net/page_pool/helpers.h>
+#include <net/xdp.h>
+#include <net/xdp_sock_drv.h>
+#include "virtio_nic.h"
+
+/* RX refill tuning */
+static int rx_refill_batch = VIRTIO_NIC_RX_REFILL_BATCH;
+
+module_param(rx_refill_batch, int, 0644);
+
+MODULE_PARM_DESC(rx_refill_batch, "Refill the RX ring once this many slots are free");
+
+/* Point a one-entry scatterlist at an already-mapped buffer */
+static void virtio_nic_sg_fill_dma(struct scatterlist *sg, dma_addr_t addr, u32 len)
+{
+    sg_init_table(sg, 1);
+    sg->dma_address = addr;
+    sg->length = len;
+}
+
+/* Size RX buffers so a full frame plus skb_shared_info fits one fragment */
+static void virtio_nic_rx_size_buffers(struct virtio_nic_queue *q)
+{
+    struct virtio_nic_priv *priv = q->priv;
+
+    q->rx_buf_len = priv->hdr_len + ETH_HLEN + VLAN_HLEN + priv->netdev->mtu;
+    q->rx_truesize = SKB_DATA_ALIGN(VIRTIO_NIC_RX_HEADROOM + q->rx_buf_len) +
+                     VIRTIO_NIC_RX_SHINFO_SIZE;
+
+    /* Start the average at a full frame; it adapts to the traffic mix */
+    ewma_pkt_len_init(&q->mrg_avg_pkt_len);
+    ewma_pkt_len_add(&q->mrg_avg_pkt_len, VIRTIO_NIC_GOOD_PACKET_LEN);
+}
+
+/* Bytes the device may write into a buffer of the given truesize */
+static unsigned int virtio_nic_rx_buf_room(unsigned int truesize)
+{
+    return truesize - SKB_DATA_ALIGN(VIRTIO_NIC_RX_HEADROOM) -
+           VIRTIO_NIC_RX_SHINFO_SIZE;
+}
+
+/* Current mergeable buffer length, tracking the queue's average packet */
+unsigned int virtio_nic_rx_mrg_len(struct virtio_nic_queue *q)
+{
+    return virtio_nic_mrg_buf_len(ewma_pkt_len_read(&q->mrg_avg_pkt_len),
+                                  q->priv->hdr_len);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rx_mrg_len);
+
+/* Create the queue's page_pool on its NUMA node and switch RX to premapped DMA */
+int virtio_nic_rx_init_queue(struct virtio_nic_queue *q)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    struct page_pool_params pp = {
+        .order     = 0,
+        .pool_size = virtqueue_get_vring_size(q->rx_vq),
+        .nid       = q->numa_node,
+        .dev       = priv->vdev->dev.parent,
+        .napi      = &q->napi,
+        .dma_dir   = DMA_FROM_DEVICE,
+        .max_len   = PAGE_SIZE,
+        .offset    = 0,
+    };
+    int err;
+
+    q->rx_ring_size = pp.pool_size;
+    virtio_nic_rx_size_buffers(q);
+
+    /* Let page_pool own the IOMMU mapping when the ring accepts it */
+    q->rx_premapped = !virtqueue_set_dma_premapped(q->rx_vq);
+    if (q->rx_premapped)
+        pp.flags = PP_FLAG_DMA_MAP | PP_FLAG_DMA_SYNC_DEV;
+
+    q->page_pool = page_pool_create(&pp);
+    if (IS_ERR(q->page_pool)) {
+        err = PTR_ERR(q->page_pool);
+        q->page_pool = NULL;
+        return err;
+    }
+
+    /* XDP frames built from our buffers recycle back into the pool */
+    err = xdp_rxq_info_reg(&q->xdp_rxq, priv->netdev, q - priv->queues, 0);
+    if (err)
+        goto destroy_pool;
+
+    err = xdp_rxq_info_reg_mem_model(&q->xdp_rxq, MEM_TYPE_PAGE_POOL, q->page_pool);
+    if (err)
+        goto unreg_rxq;
+
+    return 0;
+
+unreg_rxq:
+    xdp_rxq_info_unreg(&q->xdp_rxq);
+destroy_pool:
+    page_pool_destroy(q->page_pool);
+    q->page_pool = NULL;
+    return err;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rx_init_queue);
+
+/* Release buffers still posted to the (reset) device and destroy the pool */
+void virtio_nic_rx_cleanup_queue(struct virtio_nic_queue *q)
+{
+    void *buf;
+
+    if (!q->page_pool)
+        return;
+
+    if (q->xsk_pool)
+        virtio_nic_xsk_free_unused(q);
+
+    while ((buf = virtqueue_detach_unused_buf(q->rx_vq)) != NULL)
+        page_pool_put_full_page(q->page_pool, virt_to_head_page(buf), false);
+
+    xdp_rxq_info_unreg(&q->xdp_rxq);
+    page_pool_destroy(q->page_pool);
+    q->page_pool = NULL;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rx_cleanup_queue);
+
+/*
+ * virtqueue_reset()/virtqueue_resize() callback: return a buffer the device
+ * gave back unused, to the UMEM while a socket is bound or else to the pool.
+ */
+void virtio_nic_rx_recycle(struct virtqueue *vq, void *buf)
+{
+    struct virtio_nic_priv *priv = vq->vdev->priv;
+    struct virtio_nic_queue *q = &priv->queues[vq->index / 2];
+
+    if (q->xsk_pool)
+        xsk_buff_free(buf);
+    else
+        page_pool_put_full_page(q->page_pool, virt_to_head_page(buf), false);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rx_recycle);
+
+/*
+ * Post one page_pool fragment to the RX ring.  The token is the buffer
+ * start and the context its truesize, which varies for mergeable buffers.
+ */
+static int virtio_nic_rx_add_buf(struct virtio_nic_queue *q, gfp_t gfp)
+{
+    struct scatterlist sg;
+    unsigned int offset, len, truesize;
+    struct page *page;
+    void *buf;
+    int err;
+
+    if (q->priv->mergeable_rx_bufs) {
+        len = virtio_nic_rx_mrg_len(q);
+        /* XDP only sees single-buffer packets: never go below a full frame */
+        if (READ_ONCE(q->priv->xdp_enabled))
+            len = max(len, q->rx_buf_len);
+        truesize = SKB_DATA_ALIGN(VIRTIO_NIC_RX_HEADROOM + len) +
+                   VIRTIO_NIC_RX_SHINFO_SIZE;
+    } else {
+        len = q->rx_buf_len;
+        truesize = q->rx_truesize;
+    }
+
+    page = page_pool_alloc_frag(q->page_pool, &offset, truesize, gfp);
+    if (!page)
+        return -ENOMEM;
+
+    buf = page_address(page) + offset;
+
+    if (q->rx_premapped)
+        virtio_nic_sg_fill_dma(&sg, page_pool_get_dma_addr(page) + offset +
+                               VIRTIO_NIC_RX_HEADROOM, len);
+    else
+        sg_init_one(&sg, buf + VIRTIO_NIC_RX_HEADROOM, len);
+
+    err = virtqueue_add_inbuf_ctx(q->rx_vq, &sg, 1, buf,
+                                  (void *)(unsigned long)truesize, gfp);
+    if (err)
+        page_pool_put_full_page(q->page_pool, page, false);
+
+    return err;
+}
+
+/*
+ * Fill the RX ring in one batch and ring the doorbell once.  Like the rest
+ * of the RX ring handling this runs from NAPI or with NAPI disabled, so no
+ * lock is needed.  Returns false if allocation failed before anything could
+ * be posted, in which case the caller should fall back to the deferred
+ * refill worker.
+ */
+bool virtio_nic_rx_refill(struct virtio_nic_queue *q, gfp_t gfp)
+{
+    bool oom = false;
+    int added = 0;
+    int err;
+
+    if (q->xsk_pool)
+        return virtio_nic_xsk_refill(q, gfp);
+
+    while (q->rx_vq->num_free) {
+        err = virtio_nic_rx_add_buf(q, gfp);
+        if (err) {
+            oom = err == -ENOMEM;
+            break;
+        }
+        added++;
+    }
+
+    if (added && virtqueue_kick_prepare(q->rx_vq))
+        virtqueue_notify(q->rx_vq);
+
+    if (oom) {
+        u64_stats_update_begin(&q->rx_stats.syncp);
+        u64_stats_inc(&q->rx_stats.alloc_failed);
+        u64_stats_update_end(&q->rx_stats.syncp);
+    }
+
+    return !oom || added;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rx_refill);
+
+/* Deferred refill after GFP_ATOMIC failed in NAPI: retry with GFP_KERNEL */
+void virtio_nic_rx_refill_work(struct work_struct *work)
+{
+    struct virtio_nic_priv *priv = container_of(work, struct virtio_nic_priv,
+                                                refill_work.work);
+    bool still_empty = false;
+    int i;
+
+    for (i = 0; i < priv->active_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+
+        napi_disable(&q->napi);
+        if (!virtio_nic_rx_refill(q, GFP_KERNEL))
+            still_empty = true;
+        napi_enable(&q->napi);
+
+        /* Pick up anything that arrived while NAPI was off */
+        napi_schedule(&q->napi);
+    }
+
+    if (still_empty)
+        schedule_delayed_work(&priv->refill_work, HZ / 2);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rx_refill_work);
+
+/* Make a received fragment visible to the CPU */
+static void virtio_nic_rx_sync(struct virtio_nic_queue *q, void *buf, unsigned int len)
+{
+    struct page *page = virt_to_head_page(buf);
+
+    if (q->rx_premapped)
+        page_pool_dma_sync_for_cpu(q->page_pool, page,
+                                   buf - page_address(page) + VIRTIO_NIC_RX_HEADROOM,
+                                   len);
+}
+
+/* Wrap a received fragment in an skb without copying */
+static struct sk_buff *virtio_nic_rx_build_skb(struct virtio_nic_queue *q, void *buf,
+                                               unsigned int len, unsigned int truesize)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    struct page *page = virt_to_head_page(buf);
+    struct sk_buff *skb;
+    u32 hash = 0;
+    u16 report;
+
+    if (unlikely(len < priv->hdr_len + ETH_HLEN ||
+                 len > virtio_nic_rx_buf_room(truesize))) {
+        page_pool_put_full_page(q->page_pool, page, true);
+        return NULL;
+    }
+
+    virtio_nic_rx_sync(q, buf, len);
+
+    skb = napi_build_skb(buf, truesize);
+    if (unlikely(!skb)) {
+        page_pool_put_full_page(q->page_pool, page, true);
+        return NULL;
+    }
+
+    /* Return the page to our pool, not the page allocator, when freed */
+    skb_mark_for_recycle(skb);
+    skb_reserve(skb, VIRTIO_NIC_RX_HEADROOM + priv->hdr_len);
+    skb_put(skb, len - priv->hdr_len);
+
+    /* Reuse the device's RSS hash so the stack never computes one */
+    report = virtio_nic_hdr_hash(priv, buf + VIRTIO_NIC_RX_HEADROOM, &hash);
+    virtio_nic_skb_set_hash(skb, hash, report);
+
+    if (unlikely(!virtio_nic_skb_set_csum(priv, skb, buf + VIRTIO_NIC_RX_HEADROOM, 0))) {
+        dev_kfree_skb_any(skb);
+        return NULL;
+    }
+
+    return skb;
+}
+
+/*
+ * Hand a buffer whose contents were copied out straight back to the ring,
+ * keeping its fragment and mapping.  While XDP is on, posted buffers must
+ * hold a full frame, so older small ones go back to the pool instead.
+ */
+static bool virtio_nic_rx_repost(struct virtio_nic_queue *q, void *buf, unsigned int len,
+                                 unsigned int truesize)
+{
+    struct page *page = virt_to_head_page(buf);
+    unsigned int offset = buf - page_address(page);
+    unsigned int room = virtio_nic_rx_buf_room(truesize);
+    struct scatterlist sg;
+
+    if (unlikely(READ_ONCE(q->priv->xdp_enabled)) && room < q->rx_buf_len)
+        goto put;
+
+    if (q->rx_premapped) {
+        dma_addr_t dma = page_pool_get_dma_addr(page) + offset + VIRTIO_NIC_RX_HEADROOM;
+
+        dma_sync_single_for_device(q->priv->vdev->dev.parent, dma, len, DMA_FROM_DEVICE);
+        virtio_nic_sg_fill_dma(&sg, dma, room);
+    } else {
+        sg_init_one(&sg, buf + VIRTIO_NIC_RX_HEADROOM, room);
+    }
+
+    if (!virtqueue_add_inbuf_ctx(q->rx_vq, &sg, 1, buf,
+                                 (void *)(unsigned long)truesize, GFP_ATOMIC))
+        return true;
+
+put:
+    page_pool_put_full_page(q->page_pool, page, true);
+    return false;
+}
+
+/* True for a short frame that fits one buffer and is worth copying */
+static bool virtio_nic_rx_want_copy(struct virtio_nic_queue *q, void *buf, unsigned int len,
+                                    unsigned int copybreak)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    struct virtio_net_hdr_mrg_rxbuf *hdr = buf + VIRTIO_NIC_RX_HEADROOM;
+
+    if (len > priv->hdr_len + copybreak || len < priv->hdr_len + ETH_HLEN)
+        return false;
+    if (!priv->mergeable_rx_bufs)
+        return true;
+
+    virtio_nic_rx_sync(q, buf, priv->hdr_len);
+    return virtio16_to_cpu(priv->vdev, hdr->num_buffers) == 1;
+}
+
+/*
+ * Copy-break: copy a short frame into a fresh skb and repost its buffer,
+ * so ACKs and small RPCs do not pin full-sized buffers in the stack and
+ * the ring stays full.  The virtio_net_hdr is copied too and left just
+ * ahead of skb->data, where virtio_nic_rx_gso() looks for it.
+ */
+static struct sk_buff *virtio_nic_rx_copy(struct virtio_nic_queue *q, void *buf,
+                                          unsigned int len, unsigned int truesize,
+                                          bool *reposted)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    struct sk_buff *skb;
+    u32 hash = 0;
+    u16 report;
+
+    virtio_nic_rx_sync(q, buf, len);
+
+    skb = napi_alloc_skb(&q->napi, len);
+    if (unlikely(!skb)) {
+        page_pool_put_full_page(q->page_pool, virt_to_head_page(buf), true);
+        return NULL;
+    }
+
+    skb_put_data(skb, buf + VIRTIO_NIC_RX_HEADROOM, len);
+    __skb_pull(skb, priv->hdr_len);
+    *reposted = virtio_nic_rx_repost(q, buf, len, truesize);
+
+    report = virtio_nic_hdr_hash(priv, skb->data - priv->hdr_len, &hash);
+    virtio_nic_skb_set_hash(skb, hash, report);
+
+    if (unlikely(!virtio_nic_skb_set_csum(priv, skb, skb->data - priv->hdr_len, 0))) {
+        dev_kfree_skb_any(skb);
+        return NULL;
+    }
+
+    /* Small frames still shape the mergeable buffer size */
+    if (priv->mergeable_rx_bufs)
+        ewma_pkt_len_add(&q->mrg_avg_pkt_len, skb->len);
+
+    return skb;
+}
+
+/* Drop the remaining buffers of a mergeable packet we could not assemble */
+static void virtio_nic_rx_drain_mergeable(struct virtio_nic_queue *q, u16 num_buf)
+{
+    unsigned int len;
+    void *buf;
+
+    while (num_buf-- > 0) {
+        buf = virtio_nic_dequeue(q, &len, NULL);
+        if (!buf)
+            break;
+        page_pool_put_full_page(q->page_pool, virt_to_head_page(buf), true);
+    }
+}
+
+/*
+ * Assemble a VIRTIO_NET_F_MRG_RXBUF packet: the first buffer becomes the
+ * skb head and the following num_buffers - 1 are attached as page frags,
+ * spilling into frag_list skbs once MAX_SKB_FRAGS is reached.
+ */
+static struct sk_buff *virtio_nic_rx_receive_mergeable(struct virtio_nic_queue *q,
+                                                       void *buf, unsigned int len,
+                                                       unsigned int truesize)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    struct virtio_net_hdr_mrg_rxbuf *hdr = buf + VIRTIO_NIC_RX_HEADROOM;
+    struct sk_buff *head_skb, *curr_skb;
+    u16 num_buf;
+
+    virtio_nic_rx_sync(q, buf, priv->hdr_len);
+    num_buf = virtio16_to_cpu(priv->vdev, hdr->num_buffers);
+    if (unlikely(!num_buf)) {
+        page_pool_put_full_page(q->page_pool, virt_to_head_page(buf), true);
+        return NULL;
+    }
+
+    head_skb = virtio_nic_rx_build_skb(q, buf, len, truesize);
+    if (unlikely(!head_skb))
+        goto err_drain;
+    curr_skb = head_skb;
+
+    while (--num_buf) {
+        struct page *page;
+        unsigned int offset;
+        void *ctx;
+        int nr;
+
+        buf = virtio_nic_dequeue(q, &len, &ctx);
+        if (unlikely(!buf)) {
+            netdev_dbg(priv->netdev, "rx: %u buffers missing\n", num_buf);
+            goto err_skb;
+        }
+
+        truesize = (unsigned long)ctx;
+        page = virt_to_head_page(buf);
+        if (unlikely(len > virtio_nic_rx_buf_room(truesize))) {
+            page_pool_put_full_page(q->page_pool, page, true);
+            goto err_skb;
+        }
+
+        virtio_nic_rx_sync(q, buf, len);
+        offset = buf - page_address(page) + VIRTIO_NIC_RX_HEADROOM;
+
+        nr = skb_shinfo(curr_skb)->nr_frags;
+        if (unlikely(nr == MAX_SKB_FRAGS)) {
+            struct sk_buff *nskb = alloc_skb(0, GFP_ATOMIC);
+
+            if (unlikely(!nskb)) {
+                page_pool_put_full_page(q->page_pool, page, true);
+                goto err_skb;
+            }
+            skb_mark_for_recycle(nskb);
+            if (curr_skb == head_skb)
+                skb_shinfo(curr_skb)->frag_list = nskb;
+            else
+                curr_skb->next = nskb;
+            curr_skb = nskb;
+            head_skb->truesize += nskb->truesize;
+            nr = 0;
+        }
+
+        if (curr_skb != head_skb) {
+            head_skb->data_len += len;
+            head_skb->len += len;
+            head_skb->truesize += truesize;
+        }
+        skb_add_rx_frag(curr_skb, nr, page, offset, len, truesize);
+    }
+
+    /* Size future buffers after what this queue actually receives */
+    ewma_pkt_len_add(&q->mrg_avg_pkt_len, head_skb->len);
+    return head_skb;
+
+err_skb:
+    dev_kfree_skb(head_skb);
+err_drain:
+    virtio_nic_rx_drain_mergeable(q, num_buf - 1);
+    return NULL;
+}
+
+/* Per-poll XDP verdict counts, folded into rx_stats once per poll */
+struct virtio_nic_xdp_counts {
+    unsigned int packets;
+    unsigned int drops;
+    unsigned int tx;
+    unsigned int redirects;
+};
+
+/*
+ * Run the queue's XDP program on the raw buffer before any skb exists.
+ * Returns an skb for XDP_PASS; every other verdict consumes the buffer.
+ * Mergeable packets spanning several buffers cannot be shown to a
+ * single-buffer program and are dropped.
+ */
+static struct sk_buff *virtio_nic_rx_xdp(struct virtio_nic_queue *q, struct bpf_prog *prog,
+                                         void *buf, unsigned int len, unsigned int truesize,
+                                         struct virtio_nic_xdp_counts *xc,
+                                         unsigned int *xdp_xmit)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    struct page *page = virt_to_head_page(buf);
+    void *data = buf + VIRTIO_NIC_RX_HEADROOM + priv->hdr_len;
+    struct virtio_net_hdr hdr;
+    unsigned int metasize;
+    struct xdp_buff xdp;
+    struct sk_buff *skb;
+    u32 hash = 0;
+    u16 report;
+
+    xc->packets++;
+
+    if (unlikely(len < priv->hdr_len + ETH_HLEN ||
+                 len > virtio_nic_rx_buf_room(truesize)))
+        goto drop;
+
+    virtio_nic_rx_sync(q, buf, len);
+
+    if (priv->mergeable_rx_bufs) {
+        struct virtio_net_hdr_mrg_rxbuf *hdr = buf + VIRTIO_NIC_RX_HEADROOM;
+        u16 num_buf = virtio16_to_cpu(priv->vdev, hdr->num_buffers);
+
+        if (unlikely(num_buf != 1)) {
+            if (num_buf > 1)
+                virtio_nic_rx_drain_mergeable(q, num_buf - 1);
+            goto drop;
+        }
+    }
+
+    /* The program may rewrite the headroom, so take the hash and flags first */
+    report = virtio_nic_hdr_hash(priv, buf + VIRTIO_NIC_RX_HEADROOM, &hash);
+    memcpy(&hdr, buf + VIRTIO_NIC_RX_HEADROOM, sizeof(hdr));
+
+    xdp_init_buff(&xdp, truesize, &q->xdp_rxq);
+    xdp_prepare_buff(&xdp, buf, VIRTIO_NIC_RX_HEADROOM + priv->hdr_len,
+                     len - priv->hdr_len, true);
+
+    switch (virtio_nic_xdp_run(q, prog, &xdp, xdp_xmit)) {
+    case XDP_PASS:
+        break;
+    case XDP_TX:
+        xc->tx++;
+        return NULL;
+    case XDP_REDIRECT:
+        xc->redirects++;
+        return NULL;
+    case XDP_ABORTED:
+        xc->drops++;
+        return NULL;
+    default:
+        goto drop;
+    }
+
+    skb = napi_build_skb(buf, truesize);
+    if (unlikely(!skb))
+        goto drop;
+
+    /* The program may have moved either end of the packet */
+    skb_mark_for_recycle(skb);
+    skb_reserve(skb, xdp.data - buf);
+    skb_put(skb, xdp.data_end - xdp.data);
+    metasize = xdp.data - xdp.data_meta;
+    if (metasize)
+        skb_metadata_set(skb, metasize);
+    virtio_nic_skb_set_hash(skb, hash, report);
+
+    if (unlikely(!virtio_nic_skb_set_csum(priv, skb, &hdr, xdp.data - data))) {
+        dev_kfree_skb_any(skb);
+        xc->drops++;
+        return NULL;
+    }
+
+    return skb;
+
+drop:
+    xc->drops++;
+    page_pool_put_full_page(q->page_pool, page, true);
+    return NULL;
+}
+
+/*
+ * Turn a host-coalesced segment into a GSO skb the stack can resegment.
+ * The head buffer's virtio_net_hdr still sits just ahead of skb->data.
+ */
+static bool virtio_nic_rx_gso(struct virtio_nic_priv *priv, struct sk_buff *skb)
+{
+    const struct virtio_net_hdr *hdr = (const void *)(skb->data - priv->hdr_len);
+
+    if (hdr->gso_type == VIRTIO_NET_HDR_GSO_NONE)
+        return true;
+
+    return !virtio_net_hdr_to_skb(skb, hdr, virtio_is_little_endian(priv->vdev));
+}
+
+/* TCP goes through GRO; everything else is batched onto a list */
+static bool virtio_nic_rx_want_gro(struct sk_buff *skb)
+{
+    if (!(skb->dev->features & NETIF_F_GRO))
+        return false;
+
+    switch (skb->protocol) {
+    case htons(ETH_P_IP):
+        return pskb_may_pull(skb, sizeof(struct iphdr)) &&
+               ((struct iphdr *)skb->data)->protocol == IPPROTO_TCP;
+    case htons(ETH_P_IPV6):
+        return pskb_may_pull(skb, sizeof(struct ipv6hdr)) &&
+               ((struct ipv6hdr *)skb->data)->nexthdr == IPPROTO_TCP;
+    default:
+        return false;
+    }
+}
+
+/* Receive up to @budget packets and top the ring back up below the watermark */
+int virtio_nic_rx_poll(struct virtio_nic_queue *q, int budget)
+{
+    struct net_device *ndev = q->priv->netdev;
+    struct virtio_nic_xdp_counts xc = {};
+    unsigned int xdp_xmit = 0;
+    struct bpf_prog *prog;
+    LIST_HEAD(rx_list);
+    struct sk_buff *skb;
+    unsigned int len;
+    void *buf, *ctx;
+    int work_done = 0;
+    int dropped = 0;
+    int hashed = 0;
+    int csum_offload = 0;
+    int csum_sw = 0;
+    int copied = 0;
+    int reposted = 0;
+    unsigned int copybreak;
+    int watermark;
+
+    /* Queues bound to an AF_XDP socket receive into UMEM frames */
+    if (q->xsk_pool)
+        return virtio_nic_xsk_rx_poll(q, budget);
+
+    /* NAPI runs in a BH-disabled RCU read-side section */
+    prog = rcu_dereference(q->xdp_prog);
+    copybreak = READ_ONCE(q->priv->rx_copybreak);
+
+    while (work_done < budget) {
+        buf = virtio_nic_dequeue(q, &len, &ctx);
+        if (!buf)
+            break;
+        work_done++;
+
+        if (prog) {
+            skb = virtio_nic_rx_xdp(q, prog, buf, len, (unsigned long)ctx,
+                                    &xc, &xdp_xmit);
+            if (!skb)
+                continue;
+        } else if (virtio_nic_rx_want_copy(q, buf, len, copybreak)) {
+            bool posted = false;
+
+            skb = virtio_nic_rx_copy(q, buf, len, (unsigned long)ctx, &posted);
+            reposted += posted;
+            if (skb)
+                copied++;
+        } else if (q->priv->mergeable_rx_bufs) {
+            skb = virtio_nic_rx_receive_mergeable(q, buf, len, (unsigned long)ctx);
+        } else {
+            skb = virtio_nic_rx_build_skb(q, buf, len, (unsigned long)ctx);
+        }
+        if (!skb) {
+            dropped++;
+            continue;
+        }
+        if (!prog && unlikely(!virtio_nic_rx_gso(q->priv, skb))) {
+            dev_kfree_skb_any(skb);
+            dropped++;
+            continue;
+        }
+
+        skb->protocol = eth_type_trans(skb, ndev);
+        skb_record_rx_queue(skb, q - q->priv->queues);
+        if (q->rss_bucket_hits)
+            virtio_nic_rss_count(q, skb);
+        /* Only the device can have set a hash on a fresh skb */
+        if (skb->hash)
+            hashed++;
+        if (skb->ip_summed != CHECKSUM_NONE)
+            csum_offload++;
+        else
+            csum_sw++;
+
+        /* Update statistics */
+        u64_stats_update_begin(&q->rx_stats.syncp);
+        u64_stats_inc(&q->rx_stats.packets);
+        u64_stats_add(&q->rx_stats.bytes, skb->len);
+        u64_stats_update_end(&q->rx_stats.syncp);
+
+        if (virtio_nic_rx_want_gro(skb))
+            napi_gro_receive(&q->napi, skb);
+        else
+            list_add_tail(&skb->list, &rx_list);
+    }
+
+    /* Hand the non-GRO packets to the stack in one batch */
+    netif_receive_skb_list(&rx_list);
+
+    if (reposted && virtqueue_kick_prepare(q->rx_vq))
+        virtqueue_notify(q->rx_vq);
+
+    if (xdp_xmit)
+        virtio_nic_xdp_flush(q->priv, xdp_xmit);
+
+    if (work_done) {
+        u64_stats_update_begin(&q->rx_stats.syncp);
+        u64_stats_add(&q->rx_stats.dropped, dropped);
+        u64_stats_add(&q->rx_stats.hashed, hashed);
+        u64_stats_add(&q->rx_stats.csum_offload, csum_offload);
+        u64_stats_add(&q->rx_stats.csum_sw, csum_sw);
+        u64_stats_add(&q->rx_stats.copybreak, copied);
+        u64_stats_add(&q->rx_stats.xdp_packets, xc.packets);
+        u64_stats_add(&q->rx_stats.xdp_drops, xc.drops);
+        u64_stats_add(&q->rx_stats.xdp_tx, xc.tx);
+        u64_stats_add(&q->rx_stats.xdp_redirects, xc.redirects);
+        u64_stats_update_end(&q->rx_stats.syncp);
+    }
+
+    /* Refill in batches once enough slots have drained */
+    watermark = min_t(int, max(rx_refill_batch, 1), q->rx_ring_size / 2);
+    if (q->rx_vq->num_free >= watermark &&
+        !virtio_nic_rx_refill(q, GFP_ATOMIC))
+        schedule_delayed_work(&q->priv->refill_work, 0);
+
+    return work_done;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_rx_poll);
+
+/* Module initialization */
+static int __init virtio_nic_rx_module_init(void)
+{
+    return 0;
+}
+
+static void __exit virtio_nic_rx_module_exit(void)
+{
+    /* Cleanup handled by main driver */
+}
+
+module_init(virtio_nic_rx_module_init);
+module_exit(virtio_nic_rx_module_exit);
+
+MODULE_DESCRIPTION("page_pool backed RX refill for VirtIO NIC driver");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,271 @@
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/bpf.h>
+#include <linux/bpf_trace.h>
+#include <linux/filter.h>
+#include <linux/scatterlist.h>
+#include <linux/smp.h>
+#include <net/xdp.h>
+#include "virtio_nic.h"
+
+/* XDP TX ring used by the current CPU */
+static struct virtio_nic_xdp_sq *virtio_nic_xdp_get_sq(struct virtio_nic_priv *priv)
+{
+    return &priv->xdp_sqs[smp_processor_id() % priv->num_xdp_sqs];
+}
+
+/* Return frames the device has finished sending; called with sq->lock held */
+static void virtio_nic_xdp_reclaim(struct virtio_nic_xdp_sq *sq)
+{
+    struct xdp_frame *xdpf;
+    unsigned int len;
+
+    while ((xdpf = virtqueue_get_buf(sq->vq, &len)) != NULL)
+        xdp_return_frame(xdpf);
+}
+
+/* Prepend a zeroed virtio_net_hdr (no offloads) and post the frame */
+static int virtio_nic_xdp_add_frame(struct virtio_nic_xdp_sq *sq, struct xdp_frame *xdpf)
+{
+    unsigned int hdr_len = sq->priv->hdr_len;
+    struct scatterlist sg;
+
+    if (unlikely(xdp_frame_has_frags(xdpf)))
+        return -EOPNOTSUPP;
+    if (unlikely(xdpf->headroom < hdr_len))
+        return -EOVERFLOW;
+
+    xdpf->data -= hdr_len;
+    xdpf->len += hdr_len;
+    xdpf->headroom -= hdr_len;
+    memset(xdpf->data, 0, hdr_len);
+
+    sg_init_one(&sg, xdpf->data, xdpf->len);
+    return virtqueue_add_outbuf(sq->vq, &sg, 1, xdpf, GFP_ATOMIC);
+}
+
+/* Ring the doorbell for frames queued since the last kick; sq->lock held */
+static bool virtio_nic_xdp_kick_prepare(struct virtio_nic_xdp_sq *sq)
+{
+    if (!sq->unkicked)
+        return false;
+    sq->unkicked = 0;
+    return virtqueue_kick_prepare(sq->vq);
+}
+
+/*
+ * Queue frames on this CPU's XDP TX ring, reaping completions first so
+ * the ring never needs an interrupt.  Returns the number of frames taken;
+ * the caller still owns the rest.
+ */
+static int virtio_nic_xdp_xmit_frames(struct virtio_nic_priv *priv,
+                                      struct xdp_frame **frames, int n, bool flush)
+{
+    struct virtio_nic_xdp_sq *sq;
+    bool notify = false;
+    int i;
+
+    if (unlikely(!priv->num_xdp_sqs))
+        return 0;
+
+    sq = virtio_nic_xdp_get_sq(priv);
+    spin_lock(&sq->lock);
+
+    virtio_nic_xdp_reclaim(sq);
+    for (i = 0; i < n; i++) {
+        if (virtio_nic_xdp_add_frame(sq, frames[i]))
+            break;
+    }
+    sq->unkicked += i;
+
+    if (flush)
+        notify = virtio_nic_xdp_kick_prepare(sq);
+    spin_unlock(&sq->lock);
+
+    if (notify)
+        virtqueue_notify(sq->vq);
+
+    return i;
+}
+
+/*
+ * Run @prog on a received buffer and carry out XDP_TX and XDP_REDIRECT.
+ * Returns the verdict the caller should act on: XDP_PASS to build an skb,
+ * XDP_DROP to recycle the buffer, XDP_TX or XDP_REDIRECT if the buffer now
+ * belongs to the TX ring or the redirect target, and XDP_ABORTED if the
+ * buffer was already released but the packet is lost.
+ */
+u32 virtio_nic_xdp_run(struct virtio_nic_queue *q, struct bpf_prog *prog,
+                       struct xdp_buff *xdp, unsigned int *xdp_xmit)
+{
+    struct net_device *ndev = q->priv->netdev;
+    struct xdp_frame *xdpf;
+    u32 act;
+
+    act = bpf_prog_run_xdp(prog, xdp);
+    switch (act) {
+    case XDP_PASS:
+    case XDP_DROP:
+        return act;
+    case XDP_TX:
+        xdpf = xdp_convert_buff_to_frame(xdp);
+        if (unlikely(!xdpf))
+            break;
+        if (unlikely(virtio_nic_xdp_xmit_frames(q->priv, &xdpf, 1, false) != 1)) {
+            /* The frame owns the buffer now (a copy for AF_XDP): free it here */
+            xdp_return_frame_rx_napi(xdpf);
+            trace_xdp_exception(ndev, prog, act);
+            return XDP_ABORTED;
+        }
+        *xdp_xmit |= VIRTIO_NIC_XDP_TX;
+        return act;
+    case XDP_REDIRECT:
+        if (unlikely(xdp_do_redirect(ndev, xdp, prog)))
+            break;
+        *xdp_xmit |= VIRTIO_NIC_XDP_REDIR;
+        return act;
+    default:
+        bpf_warn_invalid_xdp_action(ndev, prog, act);
+        fallthrough;
+    case XDP_ABORTED:
+        break;
+    }
+
+    trace_xdp_exception(ndev, prog, act);
+    return XDP_DROP;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xdp_run);
+
+/* End of a NAPI poll: kick XDP_TX frames and flush redirect maps once */
+void virtio_nic_xdp_flush(struct virtio_nic_priv *priv, unsigned int xdp_xmit)
+{
+    if (xdp_xmit & VIRTIO_NIC_XDP_REDIR)
+        xdp_do_flush();
+
+    if (xdp_xmit & VIRTIO_NIC_XDP_TX) {
+        struct virtio_nic_xdp_sq *sq = virtio_nic_xdp_get_sq(priv);
+        bool notify;
+
+        spin_lock(&sq->lock);
+        notify = virtio_nic_xdp_kick_prepare(sq);
+        spin_unlock(&sq->lock);
+
+        if (notify)
+            virtqueue_notify(sq->vq);
+    }
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xdp_flush);
+
+/* ndo_xdp_xmit: frames redirected to us from another device or CPU */
+int virtio_nic_xdp_xmit(struct net_device *ndev, int n, struct xdp_frame **frames,
+                        u32 flags)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+        return -EINVAL;
+
+    if (unlikely(!priv->num_xdp_sqs || !netif_running(ndev)))
+        return -ENETDOWN;
+
+    return virtio_nic_xdp_xmit_frames(priv, frames, n, flags & XDP_XMIT_FLUSH);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xdp_xmit);
+
+/* Drop frames still posted to an XDP TX ring (device already reset) */
+void virtio_nic_xdp_free_unused(struct virtio_nic_xdp_sq *sq)
+{
+    struct xdp_frame *xdpf;
+
+    if (!sq->vq)
+        return;
+
+    while ((xdpf = virtqueue_detach_unused_buf(sq->vq)) != NULL)
+        xdp_return_frame(xdpf);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xdp_free_unused);
+
+/*
+ * Install @prog on every queue.  The pointer is swapped under RCU so NAPI
+ * keeps running; a poll in flight finishes with whichever program it read.
+ */
+static int virtio_nic_xdp_setup(struct net_device *ndev, struct bpf_prog *prog,
+                                struct netlink_ext_ack *extack)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    unsigned int frame_len;
+    bool gro_hw;
+    int i;
+
+    if (prog && prog->aux->xdp_has_frags) {
+        NL_SET_ERR_MSG_MOD(extack, "XDP multi-buffer programs are not supported");
+        return -EOPNOTSUPP;
+    }
+
+    /* The program must see whole packets, so every frame has to fit one buffer */
+    frame_len = priv->hdr_len + ETH_HLEN + VLAN_HLEN + ndev->mtu;
+    if (prog && frame_len > VIRTIO_NIC_MRG_MAX_BUF_LEN) {
+        NL_SET_ERR_MSG_MOD(extack, "MTU too large for XDP");
+        return -EINVAL;
+    }
+
+    /*
+     * Coalesced segments span several buffers, which a single-buffer
+     * program cannot see: switch device RX coalescing off while attached.
+     */
+    gro_hw = (ndev->features & NETIF_F_GRO_HW) && !!prog != priv->xdp_enabled;
+    if (gro_hw && prog &&
+        virtio_nic_set_guest_offloads(priv, priv->guest_offloads &
+                                            ~VIRTIO_NIC_GUEST_GSO_OFFLOADS)) {
+        NL_SET_ERR_MSG_MOD(extack, "XDP needs rx-gro-hw off and the device cannot switch it");
+        return -EOPNOTSUPP;
+    }
+
+    if (prog)
+        bpf_prog_add(prog, priv->num_queues - 1);
+
+    WRITE_ONCE(priv->xdp_enabled, !!prog);
+    for (i = 0; i < priv->num_queues; i++) {
+        struct virtio_nic_queue *q = &priv->queues[i];
+        struct bpf_prog *old = rtnl_dereference(q->xdp_prog);
+
+        rcu_assign_pointer(q->xdp_prog, prog);
+        if (old)
+            bpf_prog_put(old);
+    }
+
+    if (gro_hw && !prog)
+        virtio_nic_set_guest_offloads(priv, priv->guest_offloads);
+
+    return 0;
+}
+
+int virtio_nic_bpf(struct net_device *ndev, struct netdev_bpf *bpf)
+{
+    switch (bpf->command) {
+    case XDP_SETUP_PROG:
+        return virtio_nic_xdp_setup(ndev, bpf->prog, bpf->extack);
+    case XDP_SETUP_XSK_POOL:
+        return virtio_nic_xsk_pool_setup(ndev, bpf->xsk.pool, bpf->xsk.queue_id);
+    default:
+        return -EINVAL;
+    }
+}
+EXPORT_SYMBOL_GPL(virtio_nic_bpf);
+
+/* Module initialization */
+static int __init virtio_nic_xdp_init(void)
+{
+    return 0;
+}
+
+static void __exit virtio_nic_xdp_exit(void)
+{
+    /* Cleanup handled by main driver */
+}
+
+module_init(virtio_nic_xdp_init);
+module_exit(virtio_nic_xdp_exit);
+
+MODULE_DESCRIPTION("Native XDP for VirtIO NIC driver");
+MODULE_LICENSE("GPL");
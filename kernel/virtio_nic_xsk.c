@@ -0,0 +1,470 @@
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/skbuff.h>
+#include <linux/scatterlist.h>
+#include <linux/vmalloc.h>
+#include <linux/virtio_config.h>
+#include <net/xdp_sock_drv.h>
+#include "virtio_nic.h"
+
+/* Max UMEM frames taken from the fill ring per allocation call */
+#define VIRTIO_NIC_XSK_ALLOC_BATCH 64
+
+/*
+ * Post UMEM frames from the socket's fill ring.  The device writes the
+ * virtio_net_hdr into the frame headroom just ahead of xdp->data, so the
+ * packet lands where the XDP program and the socket expect it.  An empty
+ * fill ring is not an allocation failure: with need_wakeup the socket is
+ * told to kick us once it has posted more frames.
+ */
+bool virtio_nic_xsk_refill(struct virtio_nic_queue *q, gfp_t gfp)
+{
+    struct xsk_buff_pool *pool = q->xsk_pool;
+    unsigned int hdr_len = q->priv->hdr_len;
+    struct xdp_buff *bufs[VIRTIO_NIC_XSK_ALLOC_BATCH];
+    u32 frame_len = xsk_pool_get_rx_frame_size(pool) + hdr_len;
+    struct scatterlist sg;
+    bool starved = false;
+    int added = 0;
+    u32 n, i;
+
+    while (q->rx_vq->num_free) {
+        n = xsk_buff_alloc_batch(pool, bufs,
+                                 min_t(u32, q->rx_vq->num_free,
+                                       VIRTIO_NIC_XSK_ALLOC_BATCH));
+        if (!n) {
+            starved = true;
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            sg_init_table(&sg, 1);
+            sg.dma_address = xsk_buff_xdp_get_dma(bufs[i]) - hdr_len;
+            sg.length = frame_len;
+
+            if (virtqueue_add_inbuf_ctx(q->rx_vq, &sg, 1, bufs[i], NULL, gfp))
+                break;
+        }
+        added += i;
+
+        /* Ring rejected the rest of the batch: hand it back */
+        if (i < n) {
+            while (i < n)
+                xsk_buff_free(bufs[i++]);
+            break;
+        }
+    }
+
+    if (added && virtqueue_kick_prepare(q->rx_vq))
+        virtqueue_notify(q->rx_vq);
+
+    if (xsk_uses_need_wakeup(pool)) {
+        if (starved)
+            xsk_set_rx_need_wakeup(pool);
+        else
+            xsk_clear_rx_need_wakeup(pool);
+    }
+
+    return true;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xsk_refill);
+
+/* XDP_PASS on a UMEM frame: the frame goes back to the socket, so copy */
+static struct sk_buff *virtio_nic_xsk_build_skb(struct virtio_nic_queue *q,
+                                                struct xdp_buff *xdp)
+{
+    unsigned int metasize = xdp->data - xdp->data_meta;
+    unsigned int size = xdp->data_end - xdp->data_meta;
+    struct sk_buff *skb;
+
+    skb = napi_alloc_skb(&q->napi, size);
+    if (unlikely(!skb))
+        return NULL;
+
+    memcpy(__skb_put(skb, size), xdp->data_meta, size);
+    if (metasize) {
+        __skb_pull(skb, metasize);
+        skb_metadata_set(skb, metasize);
+    }
+
+    return skb;
+}
+
+/* RX poll for a queue bound to an AF_XDP socket */
+int virtio_nic_xsk_rx_poll(struct virtio_nic_queue *q, int budget)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    struct bpf_prog *prog = rcu_dereference(q->xdp_prog);
+    unsigned int xdp_xmit = 0;
+    unsigned int packets = 0, bytes = 0, dropped = 0;
+    unsigned int xdp_packets = 0, xdp_drops = 0, xdp_tx = 0, xdp_redirects = 0;
+    unsigned int hashed = 0, csum_offload = 0, csum_sw = 0;
+    struct virtio_net_hdr hdr;
+    struct xdp_buff *xdp;
+    struct sk_buff *skb;
+    unsigned int len;
+    int work_done = 0;
+    u32 act, hash = 0;
+    u16 report;
+    void *data;
+
+    while (work_done < budget) {
+        xdp = virtio_nic_dequeue(q, &len, NULL);
+        if (!xdp)
+            break;
+        work_done++;
+
+        if (unlikely(len < priv->hdr_len + ETH_HLEN)) {
+            xsk_buff_free(xdp);
+            dropped++;
+            continue;
+        }
+
+        xsk_buff_set_size(xdp, len - priv->hdr_len);
+        xsk_buff_dma_sync_for_cpu(xdp);
+        report = virtio_nic_hdr_hash(priv, xdp->data - priv->hdr_len, &hash);
+        memcpy(&hdr, xdp->data - priv->hdr_len, sizeof(hdr));
+        data = xdp->data;
+
+        act = XDP_PASS;
+        if (prog) {
+            act = virtio_nic_xdp_run(q, prog, xdp, &xdp_xmit);
+            xdp_packets++;
+        }
+
+        switch (act) {
+        case XDP_REDIRECT:
+            xdp_redirects++;
+            continue;
+        case XDP_TX:
+            xdp_tx++;
+            continue;
+        case XDP_ABORTED:
+            xdp_drops++;
+            continue;
+        case XDP_PASS:
+            skb = virtio_nic_xsk_build_skb(q, xdp);
+            if (skb && unlikely(!virtio_nic_skb_set_csum(priv, skb, &hdr, xdp->data - data))) {
+                dev_kfree_skb_any(skb);
+                skb = NULL;
+            }
+            xsk_buff_free(xdp);
+            if (unlikely(!skb)) {
+                dropped++;
+                continue;
+            }
+            break;
+        default:
+            xsk_buff_free(xdp);
+            xdp_drops++;
+            continue;
+        }
+
+        skb->protocol = eth_type_trans(skb, priv->netdev);
+        skb_record_rx_queue(skb, q - priv->queues);
+        virtio_nic_skb_set_hash(skb, hash, report);
+        if (report != VIRTIO_NET_HASH_REPORT_NONE)
+            hashed++;
+        if (skb->ip_summed != CHECKSUM_NONE)
+            csum_offload++;
+        else
+            csum_sw++;
+        packets++;
+        bytes += skb->len;
+        napi_gro_receive(&q->napi, skb);
+    }
+
+    if (xdp_xmit)
+        virtio_nic_xdp_flush(priv, xdp_xmit);
+
+    virtio_nic_xsk_refill(q, GFP_ATOMIC);
+
+    u64_stats_update_begin(&q->rx_stats.syncp);
+    u64_stats_add(&q->rx_stats.packets, packets);
+    u64_stats_add(&q->rx_stats.bytes, bytes);
+    u64_stats_add(&q->rx_stats.dropped, dropped);
+    u64_stats_add(&q->rx_stats.hashed, hashed);
+    u64_stats_add(&q->rx_stats.csum_offload, csum_offload);
+    u64_stats_add(&q->rx_stats.csum_sw, csum_sw);
+    u64_stats_add(&q->rx_stats.xdp_packets, xdp_packets);
+    u64_stats_add(&q->rx_stats.xdp_drops, xdp_drops);
+    u64_stats_add(&q->rx_stats.xdp_tx, xdp_tx);
+    u64_stats_add(&q->rx_stats.xdp_redirects, xdp_redirects);
+    u64_stats_update_end(&q->rx_stats.syncp);
+
+    return work_done;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xsk_rx_poll);
+
+/*
+ * Describe a UMEM frame for the TX ring, one entry per page.  The TX ring
+ * is not premapped, so the virtio core maps each entry's page; the UMEM is
+ * vmap()ed, so those pages must come from vmalloc_to_page().  Bind checks
+ * that a frame always fits in the slot's table.
+ */
+static void virtio_nic_xsk_frame_sg(struct scatterlist *sg, void *data, u32 len)
+{
+    do {
+        unsigned int off = offset_in_page(data);
+        unsigned int chunk = min_t(u32, len, PAGE_SIZE - off);
+
+        sg_set_page(sg, vmalloc_to_page(data), chunk, off);
+        data += chunk;
+        len -= chunk;
+        if (!len)
+            sg_mark_end(sg);
+        sg++;
+    } while (len);
+}
+
+/*
+ * Move descriptors from the socket's TX ring onto the queue's TX virtqueue,
+ * sharing it with the stack under the subqueue's xmit lock.  Each frame is
+ * sent behind the queue's zeroed virtio_net_hdr.  A frame the virtqueue
+ * refuses is held and sent first next time: completing it early would hand
+ * the socket back a frame while older ones are still in flight.  Returns
+ * true once the socket ring is drained, false if @budget ran out first.
+ */
+bool virtio_nic_xsk_xmit(struct virtio_nic_queue *q, int budget)
+{
+    struct xsk_buff_pool *pool = q->xsk_pool;
+    struct netdev_queue *txq = virtio_nic_txq(q);
+    struct virtio_nic_tx_slot *slot;
+    struct xdp_desc desc;
+    unsigned int bytes = 0;
+    int sent = 0;
+
+    __netif_tx_lock(txq, raw_smp_processor_id());
+    txq_trans_cond_update(txq);
+
+    while (sent < budget && virtio_nic_tx_has_room(q)) {
+        if (q->xsk_tx_held)
+            desc = q->xsk_tx_desc;
+        else if (!xsk_tx_peek_desc(pool, &desc))
+            break;
+
+        slot = virtio_nic_tx_slot_get(q);
+        slot->xsk = true;
+        sg_init_table(slot->sg, VIRTIO_NIC_TX_MAX_SG);
+        sg_set_buf(&slot->sg[0], &q->xsk_hdr, q->priv->hdr_len);
+        virtio_nic_xsk_frame_sg(&slot->sg[1], xsk_buff_raw_get_data(pool, desc.addr),
+                                desc.len);
+
+        if (unlikely(virtio_nic_enqueue(q, slot->sg, 1, 0, slot, false))) {
+            virtio_nic_tx_slot_put(q, slot);
+            q->xsk_tx_desc = desc;
+            q->xsk_tx_held = true;
+            break;
+        }
+
+        q->xsk_tx_held = false;
+        sent++;
+        bytes += desc.len;
+    }
+
+    if (sent) {
+        xsk_tx_release(pool);
+        virtio_nic_tx_kick(q);
+
+        u64_stats_update_begin(&q->tx_stats.syncp);
+        u64_stats_add(&q->tx_stats.packets, sent);
+        u64_stats_add(&q->tx_stats.bytes, bytes);
+        u64_stats_update_end(&q->tx_stats.syncp);
+    }
+
+    __netif_tx_unlock(txq);
+
+    /* We only look at the TX ring when NAPI runs, so ask for a kick */
+    if (xsk_uses_need_wakeup(pool))
+        xsk_set_tx_need_wakeup(pool);
+
+    return sent < budget;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xsk_xmit);
+
+/* Return UMEM frames still posted to the RX ring (device already reset) */
+void virtio_nic_xsk_free_unused(struct virtio_nic_queue *q)
+{
+    void *buf;
+
+    while ((buf = virtqueue_detach_unused_buf(q->rx_vq)) != NULL)
+        xsk_buff_free(buf);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xsk_free_unused);
+
+/*
+ * Swap the RX ring of one queue between page_pool buffers and UMEM frames.
+ * virtqueue_reset() takes the ring back from the device without touching
+ * the other queues.  On unbind the TX ring is reset too, so no descriptor
+ * still points into the UMEM.
+ */
+static int virtio_nic_xsk_swap_rx(struct virtio_nic_queue *q, struct xsk_buff_pool *pool)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    struct netdev_queue *txq = virtio_nic_txq(q);
+    bool running = netif_running(priv->netdev);
+    int err;
+
+    /* Ring reset sleeps, so quiesce the queue rather than hold its locks */
+    if (running) {
+        napi_disable(&q->napi);
+        if (!pool) {
+            __netif_tx_lock_bh(txq);
+            netif_tx_stop_queue(txq);
+            __netif_tx_unlock_bh(txq);
+        }
+    }
+
+    err = virtqueue_reset(q->rx_vq, virtio_nic_rx_recycle);
+    if (err)
+        goto out;
+
+    if (!pool) {
+        err = virtqueue_reset(q->tx_vq, virtio_nic_tx_recycle);
+        if (err)
+            netdev_warn(priv->netdev, "tx%d reset failed: %d\n",
+                        (int)(q - priv->queues), err);
+        /* Nothing is in flight any more, so a held frame can complete too */
+        if (q->xsk_tx_held) {
+            xsk_tx_completed(q->xsk_pool, 1);
+            q->xsk_tx_held = false;
+        }
+        netdev_tx_reset_queue(txq);
+        err = 0;
+    }
+
+    q->xsk_pool = pool;
+    if (running && !virtio_nic_rx_refill(q, GFP_KERNEL))
+        schedule_delayed_work(&priv->refill_work, 0);
+
+out:
+    if (running) {
+        if (!pool)
+            netif_tx_wake_queue(txq);
+        napi_enable(&q->napi);
+        napi_schedule(&q->napi);
+    }
+    return err;
+}
+
+static int virtio_nic_xsk_enable(struct virtio_nic_queue *q, struct xsk_buff_pool *pool)
+{
+    struct virtio_nic_priv *priv = q->priv;
+    int qid = q - priv->queues;
+    int err;
+
+    /* UMEM frames are posted by DMA address and swapped in by ring reset */
+    if (!q->rx_premapped || !virtio_has_feature(priv->vdev, VIRTIO_F_RING_RESET))
+        return -EOPNOTSUPP;
+
+    if (q->xsk_pool)
+        return -EBUSY;
+
+    if (xsk_pool_get_rx_frame_size(pool) < ETH_HLEN + VLAN_HLEN + priv->netdev->mtu)
+        return -EINVAL;
+
+    /* A TX frame at any offset must fit the slot's sg table, header aside */
+    if (xsk_pool_get_chunk_size(pool) > (VIRTIO_NIC_TX_MAX_SG - 2) * PAGE_SIZE)
+        return -EINVAL;
+
+    err = xdp_rxq_info_reg(&q->xsk_rxq, priv->netdev, qid, q->napi.napi_id);
+    if (err)
+        return err;
+
+    err = xdp_rxq_info_reg_mem_model(&q->xsk_rxq, MEM_TYPE_XSK_BUFF_POOL, NULL);
+    if (err)
+        goto unreg_rxq;
+
+    xsk_pool_set_rxq_info(pool, &q->xsk_rxq);
+
+    err = xsk_pool_dma_map(pool, priv->vdev->dev.parent, 0);
+    if (err)
+        goto unreg_rxq;
+
+    err = virtio_nic_xsk_swap_rx(q, pool);
+    if (err)
+        goto unmap;
+
+    return 0;
+
+unmap:
+    xsk_pool_dma_unmap(pool, 0);
+unreg_rxq:
+    xdp_rxq_info_unreg(&q->xsk_rxq);
+    return err;
+}
+
+static int virtio_nic_xsk_disable(struct virtio_nic_queue *q)
+{
+    struct xsk_buff_pool *pool = q->xsk_pool;
+    int err;
+
+    if (!pool)
+        return -EINVAL;
+
+    err = virtio_nic_xsk_swap_rx(q, NULL);
+    if (err)
+        return err;
+
+    xsk_pool_dma_unmap(pool, 0);
+    xdp_rxq_info_unreg(&q->xsk_rxq);
+    return 0;
+}
+
+/* ndo_bpf XDP_SETUP_XSK_POOL: bind or unbind a UMEM on one queue */
+int virtio_nic_xsk_pool_setup(struct net_device *ndev, struct xsk_buff_pool *pool, u16 qid)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+
+    if (qid >= priv->active_queues)
+        return -EINVAL;
+
+    return pool ? virtio_nic_xsk_enable(&priv->queues[qid], pool) :
+                  virtio_nic_xsk_disable(&priv->queues[qid]);
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xsk_pool_setup);
+
+/* ndo_xsk_wakeup: the socket posted frames or wants TX to make progress */
+int virtio_nic_xsk_wakeup(struct net_device *ndev, u32 qid, u32 flags)
+{
+    struct virtio_nic_priv *priv = netdev_priv(ndev);
+    struct virtio_nic_queue *q;
+
+    if (!netif_running(ndev))
+        return -ENETDOWN;
+
+    if (qid >= priv->active_queues)
+        return -EINVAL;
+
+    q = &priv->queues[qid];
+    if (!READ_ONCE(q->xsk_pool))
+        return -EINVAL;
+
+    /* If NAPI is already running it will go round once more */
+    if (!napi_if_scheduled_mark_missed(&q->napi)) {
+        local_bh_disable();
+        napi_schedule(&q->napi);
+        local_bh_enable();
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(virtio_nic_xsk_wakeup);
+
+/* Module initialization */
+static int __init virtio_nic_xsk_init(void)
+{
+    return 0;
+}
+
+static void __exit virtio_nic_xsk_exit(void)
+{
+    /* Cleanup handled by main driver */
+}
+
+module_init(virtio_nic_xsk_init);
+module_exit(virtio_nic_xsk_exit);
+
+MODULE_DESCRIPTION("AF_XDP zero-copy for VirtIO NIC driver");
+MODULE_LICENSE("GPL");
@@ -9,7 +9,7 @@ import time
 import threading
 import statistics
 from dataclasses import dataclass
-from typing import List, Dict, Optional
+from typing import Callable, List, Dict, Optional, Tuple
 import requests
 
 @dataclass
@@ -27,10 +27,15 @@ class BenchmarkResult:
 class VirtIONicBenchmark:
     """Comprehensive VirtIO NIC benchmark suite."""
     
-    def __init__(self, target_host: str, duration: int = 30):
+    MODULE_PARAM_DIR = "/sys/module/virtio_nic/parameters"
+    TELEMETRY_DIR = "/sys/kernel/virtio_nic_telemetry"
+
+    def __init__(self, target_host: str, duration: int = 30, hypervisor_host: Optional[str] = None):
         self.target_host = target_host
         self.duration = duration
+        self.hypervisor_host = hypervisor_host
         self.results: List[BenchmarkResult] = []
+        self.comparisons: Dict[str, Dict] = {}
         
     def run_iperf3_test(self, reverse: bool = False, protocol: str = "tcp") -> Dict:
         """Run iperf3 test and parse results."""
@@ -283,6 +288,656 @@ class VirtIONicBenchmark:
         self.results.append(result)
         return result
     
+    def set_module_param(self, name: str, value) -> bool:
+        """Write a virtio_nic module parameter through sysfs."""
+        try:
+            with open(f"{self.MODULE_PARAM_DIR}/{name}", 'w') as f:
+                f.write(f"{value}\n")
+            return True
+        except OSError as e:
+            print(f"Failed to set {name}={value}: {e}")
+            return False
+
+    def read_telemetry_table(self, name: str) -> List[List[str]]:
+        """Read a tab-separated telemetry table, skipping the two header lines."""
+        try:
+            with open(f"{self.TELEMETRY_DIR}/{name}", 'r') as f:
+                lines = f.read().splitlines()[2:]
+            return [line.split('\t') for line in lines if line]
+        except OSError:
+            return []
+
+    def sum_telemetry_column(self, name: str, column: int) -> int:
+        """Sum one numeric column of a per-queue telemetry table."""
+        total = 0
+        for row in self.read_telemetry_table(name):
+            if len(row) > column:
+                try:
+                    total += int(row[column])
+                except ValueError:
+                    pass
+        return total
+
+    def telemetry_deltas(self, name: str, columns: Tuple[int, ...], run: Callable):
+        """Call run() and return its result with how far each telemetry column advanced."""
+        before = [self.sum_telemetry_column(name, col) for col in columns]
+        result = run()
+        return result, [self.sum_telemetry_column(name, col) - b for col, b in zip(columns, before)]
+
+    def read_host_exits(self) -> Optional[int]:
+        """Read the KVM exit counter on the hypervisor (requires --hypervisor)."""
+        if not self.hypervisor_host:
+            return None
+        try:
+            result = subprocess.run(["ssh", self.hypervisor_host, "cat /sys/kernel/debug/kvm/exits"],
+                                    capture_output=True, text=True, timeout=10)
+            if result.returncode == 0:
+                return int(result.stdout.strip())
+        except (subprocess.TimeoutExpired, ValueError) as e:
+            print(f"Failed to read host exits: {e}")
+        return None
+
+    def run_pps_test(self, packet_size: int = 64, streams: int = 8, reverse: bool = False) -> float:
+        """Run an unthrottled UDP iperf3 test and return packets per second."""
+        cmd = [
+            "iperf3", "-c", self.target_host,
+            "-t", str(self.duration),
+            "-J", "-u", "-b", "0",
+            "-l", str(packet_size),
+            "-P", str(streams)
+        ]
+        if reverse:
+            cmd.append("-R")
+
+        try:
+            result = subprocess.run(cmd, capture_output=True, text=True, timeout=self.duration + 10)
+            if result.returncode != 0:
+                print(f"iperf3 failed: {result.stderr}")
+                return 0.0
+            summary = json.loads(result.stdout).get('end', {}).get('sum', {})
+            seconds = summary.get('seconds', 0)
+            return summary.get('packets', 0) / seconds if seconds else 0.0
+        except (subprocess.TimeoutExpired, json.JSONDecodeError) as e:
+            print(f"pps test failed: {e}")
+            return 0.0
+
+    def run_doorbell_test(self, packet_size: int = 64) -> Dict:
+        """Compare pps and host exit rate with per-packet kicks vs xmit_more batching."""
+        print("Running doorbell batching test...")
+
+        comparison = {}
+        for label, batch in (("per_packet_kick", 0), ("batched_kick", 64)):
+            if not self.set_module_param("tx_kick_batch", batch):
+                continue
+
+            kicks_before = self.sum_telemetry_column("tx_kick_stats", 1)
+            pkts_before = self.sum_telemetry_column("tx_kick_stats", 2)
+            exits_before = self.read_host_exits()
+            start = time.time()
+
+            pps = self.run_pps_test(packet_size)
+
+            elapsed = time.time() - start
+            kicks = self.sum_telemetry_column("tx_kick_stats", 1) - kicks_before
+            pkts = self.sum_telemetry_column("tx_kick_stats", 2) - pkts_before
+            exits_after = self.read_host_exits()
+
+            entry = {
+                "tx_kick_batch": batch,
+                "pps": pps,
+                "kicks_per_sec": kicks / elapsed if elapsed else 0,
+                "packets_per_kick": pkts / kicks if kicks else 0,
+            }
+            if exits_before is not None and exits_after is not None:
+                entry["host_exits_per_sec"] = (exits_after - exits_before) / elapsed if elapsed else 0
+            comparison[label] = entry
+
+        base = comparison.get("per_packet_kick", {}).get("pps", 0)
+        if base and "batched_kick" in comparison:
+            comparison["pps_gain_percent"] = (comparison["batched_kick"]["pps"] / base - 1) * 100
+
+        self.comparisons["doorbell_batching"] = comparison
+        return comparison
+
+    def run_multiqueue_pps_test(self, packet_size: int = 64,
+                                stream_counts: tuple = (1, 8, 16, 32)) -> Dict:
+        """Measure small-packet pps as parallel streams spread across queues."""
+        print("Running multi-queue pps test...")
+
+        comparison = {}
+        for streams in stream_counts:
+            comparison[f"streams_{streams}_pps"] = self.run_pps_test(packet_size, streams)
+
+        single = comparison.get(f"streams_{stream_counts[0]}_pps", 0)
+        widest = comparison.get(f"streams_{stream_counts[-1]}_pps", 0)
+        comparison["scaling_factor"] = widest / single if single else 0
+
+        self.comparisons["multiqueue_pps"] = comparison
+        return comparison
+
+    def read_rx_packets(self, iface: str) -> int:
+        """Packets the driver handed to the stack on an interface."""
+        try:
+            with open(f"/sys/class/net/{iface}/statistics/rx_packets", 'r') as f:
+                return int(f.read().strip())
+        except (OSError, ValueError):
+            return 0
+
+    def set_xdp_program(self, iface: str, mode: str, obj: Optional[str]) -> bool:
+        """Attach an XDP object in the given mode (xdpdrv/xdpgeneric), or detach if obj is None."""
+        cmd = ["ip", "link", "set", "dev", iface, mode]
+        cmd += ["obj", obj, "sec", "xdp"] if obj else ["off"]
+        result = subprocess.run(cmd, capture_output=True, text=True)
+        if result.returncode != 0:
+            print(f"{' '.join(cmd)} failed: {result.stderr.strip()}")
+            return False
+        return True
+
+    def run_xdp_drop_test(self, iface: str, xdp_obj: str, pktgen_cmd: str) -> Dict:
+        """
+        Mpps an XDP_DROP program sustains, native vs generic XDP.  Traffic
+        comes from pktgen on the QEMU host, aimed at the guest's tap peer.
+        """
+        print("Running XDP_DROP test...")
+
+        if not self.hypervisor_host or not pktgen_cmd:
+            print("XDP_DROP test needs --hypervisor and --pktgen-cmd")
+            return {}
+
+        comparison = {}
+        for label, mode in (("generic_xdp", "xdpgeneric"), ("native_xdp", "xdpdrv")):
+            if not self.set_xdp_program(iface, mode, xdp_obj):
+                continue
+
+            # Native drops never reach rx_packets; generic drops do
+            rx_before = self.read_rx_packets(iface)
+            drops_before = self.sum_telemetry_column("xdp_stats", 2)
+            start = time.time()
+
+            try:
+                subprocess.run(["ssh", self.hypervisor_host, pktgen_cmd],
+                               capture_output=True, text=True, timeout=self.duration + 30)
+            except subprocess.TimeoutExpired:
+                print("pktgen did not finish in time")
+
+            elapsed = time.time() - start
+            processed = (self.read_rx_packets(iface) - rx_before +
+                         self.sum_telemetry_column("xdp_stats", 2) - drops_before)
+            self.set_xdp_program(iface, mode, None)
+
+            comparison[f"{label}_mpps"] = processed / elapsed / 1e6 if elapsed else 0
+
+        generic = comparison.get("generic_xdp_mpps", 0)
+        if generic and "native_xdp_mpps" in comparison:
+            comparison["native_speedup"] = comparison["native_xdp_mpps"] / generic
+
+        self.comparisons["xdp_drop"] = comparison
+        return comparison
+
+    def reload_module(self, iface: str, **params) -> bool:
+        """Reload virtio_nic with load-time parameters and wait for the link."""
+        args = [f"{name}={value}" for name, value in params.items()]
+        for cmd in (["modprobe", "-r", "virtio_nic"], ["modprobe", "virtio_nic"] + args,
+                    ["ip", "link", "set", "dev", iface, "up"]):
+            result = subprocess.run(cmd, capture_output=True, text=True)
+            if result.returncode != 0:
+                print(f"{' '.join(cmd)} failed: {result.stderr.strip()}")
+                return False
+        time.sleep(2)
+        return True
+
+    def run_reload_ab(self, iface: str, name: str, variants: List[Tuple[str, Dict]],
+                      measure: Callable[[str, Dict], Optional[Dict]]) -> Dict:
+        """
+        A/B load-time parameters: reload the driver with each (label, params)
+        variant, merge what measure(label, params) returns into the
+        comparison, then leave the driver in its default configuration.
+        """
+        comparison = {}
+        for label, params in variants:
+            if self.reload_module(iface, **params):
+                comparison.update(measure(label, params) or {})
+
+        self.reload_module(iface)
+
+        self.comparisons[name] = comparison
+        return comparison
+
+    def ring_is_packed(self, iface: str) -> bool:
+        """True if the device negotiated VIRTIO_F_RING_PACKED (feature bit 34)."""
+        try:
+            with open(f"/sys/class/net/{iface}/device/features", 'r') as f:
+                bits = f.read().strip()
+            return len(bits) > 34 and bits[34] == '1'
+        except OSError:
+            return False
+
+    def run_ring_layout_test(self, iface: str, queue_counts: tuple = (8, 16, 32),
+                             packet_sizes: tuple = (64, 1500)) -> Dict:
+        """Split vs packed virtqueues; the layout is negotiated, so each run reloads the driver."""
+        print("Running split vs packed ring test...")
+
+        def measure(label: str, params: Dict) -> Optional[Dict]:
+            if self.ring_is_packed(iface) != bool(params["enable_packed_ring"]):
+                print(f"Device did not negotiate a {label} ring; skipping")
+                return None
+            queues = params["num_queues"]
+            return {f"{label}_q{queues}_{size}B_pps": self.run_pps_test(size, queues)
+                    for size in packet_sizes}
+
+        comparison = self.run_reload_ab(iface, "ring_layout", [
+            (layout, {"enable_packed_ring": packed, "num_queues": queues})
+            for layout, packed in (("split", 0), ("packed", 1)) for queues in queue_counts
+        ], measure)
+
+        for queues in queue_counts:
+            for size in packet_sizes:
+                split = comparison.get(f"split_q{queues}_{size}B_pps", 0)
+                packed = comparison.get(f"packed_q{queues}_{size}B_pps")
+                if split and packed is not None:
+                    comparison[f"q{queues}_{size}B_packed_gain_percent"] = (packed / split - 1) * 100
+
+        return comparison
+
+    def run_event_idx_test(self, iface: str, packet_size: int = 64) -> Dict:
+        """Interrupts per packet and latency with and without VIRTIO_RING_F_EVENT_IDX."""
+        print("Running event index test...")
+
+        def measure(label: str, params: Dict) -> Dict:
+            (pps, latency), (rx_irqs, tx_irqs, pkts) = self.telemetry_deltas(
+                "irq_stats", (1, 2, 3),
+                lambda: (self.run_pps_test(packet_size), self.measure_latency()))
+            return {label: {
+                "pps": pps,
+                "irqs_per_packet": (rx_irqs + tx_irqs) / pkts if pkts else 0,
+                "avg_latency_us": latency["avg_latency_us"],
+            }}
+
+        comparison = self.run_reload_ab(iface, "event_idx", [
+            ("no_event_idx", {"enable_event_idx": 0}),
+            ("event_idx", {"enable_event_idx": 1}),
+        ], measure)
+
+        base = comparison.get("no_event_idx", {}).get("irqs_per_packet", 0)
+        if base and "event_idx" in comparison:
+            comparison["irq_reduction_percent"] = (1 - comparison["event_idx"]["irqs_per_packet"] / base) * 100
+
+        return comparison
+
+    def run_in_order_test(self, iface: str, packet_size: int = 64) -> Dict:
+        """TX completion cost per packet with and without VIRTIO_F_IN_ORDER."""
+        print("Running in-order completion test...")
+
+        def measure(label: str, params: Dict) -> Optional[Dict]:
+            active = any(row[1] == '1' for row in self.read_telemetry_table("tx_completion_stats")
+                         if len(row) > 1)
+            if active != bool(params["enable_in_order"]):
+                print(f"Device did not negotiate {label} completion; skipping")
+                return None
+
+            pps, (done, ns) = self.telemetry_deltas(
+                "tx_completion_stats", (2, 3), lambda: self.run_pps_test(packet_size))
+            return {label: {
+                "pps": pps,
+                "reclaim_ns_per_packet": ns / done if done else 0,
+            }}
+
+        comparison = self.run_reload_ab(iface, "in_order", [
+            ("out_of_order", {"enable_in_order": 0}),
+            ("in_order", {"enable_in_order": 1}),
+        ], measure)
+
+        base = comparison.get("out_of_order", {}).get("reclaim_ns_per_packet", 0)
+        if base and "in_order" in comparison:
+            comparison["reclaim_cost_reduction_percent"] = (
+                1 - comparison["in_order"]["reclaim_ns_per_packet"] / base) * 100
+
+        return comparison
+
+    def run_tx_copybreak_test(self, iface: str, packet_sizes: tuple = (64, 128),
+                              threshold: int = 256) -> Dict:
+        """Small-packet pps with TX copy-break off and on, plus the copy hit ratio."""
+        print("Running TX copy-break test...")
+
+        def measure(label: str, params: Dict) -> Dict:
+            result = {}
+            for size in packet_sizes:
+                pps, (pkts, copied) = self.telemetry_deltas(
+                    "tx_copybreak_stats", (2, 3), lambda: self.run_pps_test(size))
+                result[f"{label}_{size}B_pps"] = pps
+                result[f"{label}_{size}B_hit_ratio"] = copied / pkts if pkts else 0
+            return result
+
+        comparison = self.run_reload_ab(iface, "tx_copybreak", [
+            ("mapped", {"tx_copybreak": 0}),
+            ("copybreak", {"tx_copybreak": threshold}),
+        ], measure)
+
+        for size in packet_sizes:
+            mapped = comparison.get(f"mapped_{size}B_pps", 0)
+            copied = comparison.get(f"copybreak_{size}B_pps")
+            if mapped and copied is not None:
+                comparison[f"{size}B_copybreak_gain_percent"] = (copied / mapped - 1) * 100
+
+        return comparison
+
+    def set_rx_copybreak(self, iface: str, value: int) -> bool:
+        """Set the per-device RX copy-break threshold through ethtool."""
+        cmd = ["ethtool", "--set-tunable", iface, "rx-copybreak", str(value)]
+        result = subprocess.run(cmd, capture_output=True, text=True)
+        if result.returncode != 0:
+            print(f"{' '.join(cmd)} failed: {result.stderr.strip()}")
+            return False
+        return True
+
+    def read_meminfo_kb(self, field: str) -> int:
+        """One /proc/meminfo field in kB."""
+        try:
+            with open("/proc/meminfo", 'r') as f:
+                for line in f:
+                    if line.startswith(field + ":"):
+                        return int(line.split()[1])
+        except (OSError, ValueError):
+            pass
+        return 0
+
+    def run_rx_copybreak_test(self, iface: str, packet_sizes: tuple = (64, 1500),
+                              threshold: int = 256) -> Dict:
+        """
+        Receive-side pps, copy ratio and free memory with RX copy-break off
+        and on.  Small frames should be copied and large ones left alone.
+        """
+        print("Running RX copy-break test...")
+
+        comparison = {}
+        for label, copybreak in (("no_copy", 0), ("copybreak", threshold)):
+            if not self.set_rx_copybreak(iface, copybreak):
+                continue
+            for size in packet_sizes:
+                mem_before = self.read_meminfo_kb("MemAvailable")
+
+                comparison[f"{label}_{size}B_pps"], (pkts, copied) = self.telemetry_deltas(
+                    "rx_copybreak_stats", (1, 2), lambda: self.run_pps_test(size, reverse=True))
+                comparison[f"{label}_{size}B_copy_ratio"] = copied / pkts if pkts else 0
+                comparison[f"{label}_{size}B_mem_used_kb"] = (
+                    mem_before - self.read_meminfo_kb("MemAvailable"))
+
+        for size in packet_sizes:
+            base = comparison.get(f"no_copy_{size}B_pps", 0)
+            copied = comparison.get(f"copybreak_{size}B_pps")
+            if base and copied is not None:
+                comparison[f"{size}B_copybreak_gain_percent"] = (copied / base - 1) * 100
+
+        self.set_rx_copybreak(iface, threshold)
+
+        self.comparisons["rx_copybreak"] = comparison
+        return comparison
+
+    def run_indirect_desc_test(self, iface: str) -> Dict:
+        """TSO throughput, ring slots per packet and ring-full stops with and without indirect descriptors."""
+        print("Running indirect descriptor test...")
+
+        def measure(label: str, params: Dict) -> Dict:
+            result, (pkts, descs, stops) = self.telemetry_deltas(
+                "tx_ring_stats", (2, 3, 5), lambda: self.run_iperf3_test(protocol="tcp"))
+            return {label: {
+                "throughput_gbps": result.get('end', {}).get('sum_sent', {}).get('bits_per_second', 0) / 1e9,
+                "descs_per_packet": descs / pkts if pkts else 0,
+                "ring_full_stops": stops,
+            }}
+
+        return self.run_reload_ab(iface, "indirect_desc", [
+            ("direct", {"enable_indirect_desc": 0}),
+            ("indirect", {"enable_indirect_desc": 1}),
+        ], measure)
+
+    def run_ctrl_batch_test(self, iface: str, rounds: int = 20, packet_size: int = 64) -> Dict:
+        """
+        Cost of reprogramming coalescing on every queue while traffic runs:
+        ethtool -C latency, commands per ctrl vq kick, and the pps seen
+        by a concurrent stream versus an undisturbed one.
+        """
+        print("Running control queue batching test...")
+
+        comparison = {"baseline_pps": self.run_pps_test(packet_size)}
+
+        cmds_before = self.sum_telemetry_column("ctrl_stats", 0)
+        kicks_before = self.sum_telemetry_column("ctrl_stats", 1)
+        latencies = []
+        result = {}
+
+        pps_thread = threading.Thread(
+            target=lambda: result.update(pps=self.run_pps_test(packet_size)))
+        pps_thread.start()
+        for i in range(rounds):
+            usecs = 8 if i % 2 else 64
+            start = time.time()
+            proc = subprocess.run(["ethtool", "-C", iface, "rx-usecs", str(usecs),
+                                   "tx-usecs", str(usecs)], capture_output=True, text=True)
+            if proc.returncode != 0:
+                print(f"ethtool -C failed: {proc.stderr.strip()}")
+                break
+            latencies.append((time.time() - start) * 1000)
+            time.sleep(self.duration / (rounds + 1))
+        pps_thread.join()
+
+        cmds = self.sum_telemetry_column("ctrl_stats", 0) - cmds_before
+        kicks = self.sum_telemetry_column("ctrl_stats", 1) - kicks_before
+        comparison["reconfig_pps"] = result.get("pps", 0)
+        comparison["ethtool_ms_mean"] = statistics.mean(latencies) if latencies else 0
+        comparison["cmds_per_kick"] = cmds / kicks if kicks else 0
+        if comparison["baseline_pps"]:
+            comparison["pps_loss_percent"] = (
+                1 - comparison["reconfig_pps"] / comparison["baseline_pps"]) * 100
+
+        self.comparisons["ctrl_batch"] = comparison
+        return comparison
+
+    def run_channels_test(self, iface: str, packet_size: int = 64) -> Dict:
+        """
+        Live channel changes: pps at each combined count reachable with
+        ethtool -L, and how long each change takes.  The module must be
+        loaded with num_queues at the largest count wanted.
+        """
+        print("Running runtime channel change test...")
+
+        proc = subprocess.run(["ethtool", "-l", iface], capture_output=True, text=True)
+        if proc.returncode != 0:
+            print(f"ethtool -l failed: {proc.stderr.strip()}")
+            return {}
+        # The first Combined line is the maximum, the second the current count
+        combined = [int(line.split()[-1]) for line in proc.stdout.splitlines()
+                    if line.strip().startswith("Combined:")]
+        if len(combined) < 2:
+            print("No combined channel counts reported")
+            return {}
+        max_channels, original = combined[0], combined[1]
+
+        counts = sorted({1, max(1, max_channels // 2), max_channels})
+        comparison = {}
+        latencies = []
+        for count in counts:
+            start = time.time()
+            proc = subprocess.run(["ethtool", "-L", iface, "combined", str(count)],
+                                  capture_output=True, text=True)
+            if proc.returncode != 0:
+                print(f"ethtool -L combined {count} failed: {proc.stderr.strip()}")
+                continue
+            latencies.append((time.time() - start) * 1000)
+            comparison[f"pps_{count}_channels"] = self.run_pps_test(packet_size, streams=max_channels)
+
+        subprocess.run(["ethtool", "-L", iface, "combined", str(original)], capture_output=True)
+
+        comparison["ethtool_ms_mean"] = statistics.mean(latencies) if latencies else 0
+        self.comparisons["channels"] = comparison
+        return comparison
+
+    def run_ring_size_test(self, iface: str, sizes: Optional[List[int]] = None,
+                           packet_size: int = 64) -> Dict:
+        """
+        Live ring resizes with ethtool -G: per size, the time the resize
+        takes, the memory the queues then hold, pps, and latency measured
+        while a bulk stream runs (the bufferbloat a deep ring adds).
+        """
+        print("Running ring size test...")
+
+        proc = subprocess.run(["ethtool", "-g", iface], capture_output=True, text=True)
+        if proc.returncode != 0:
+            print(f"ethtool -g failed: {proc.stderr.strip()}")
+            return {}
+        # Maximums are listed first, then the current settings
+        rx = [int(line.split()[-1]) for line in proc.stdout.splitlines()
+              if line.strip().startswith("RX:")]
+        tx = [int(line.split()[-1]) for line in proc.stdout.splitlines()
+              if line.strip().startswith("TX:")]
+        if len(rx) < 2 or len(tx) < 2:
+            print("No ring sizes reported")
+            return {}
+
+        sizes = sizes or [256, 1024, min(rx[0], tx[0])]
+        comparison = {}
+        for size in sorted(set(sizes)):
+            start = time.time()
+            proc = subprocess.run(["ethtool", "-G", iface, "rx", str(size), "tx", str(size)],
+                                  capture_output=True, text=True)
+            if proc.returncode != 0:
+                print(f"ethtool -G {size} failed: {proc.stderr.strip()}")
+                continue
+            comparison[f"resize_ms_{size}"] = (time.time() - start) * 1000
+            comparison[f"mem_kib_{size}"] = self.sum_telemetry_column("ring_mem_stats", 6) / 1024
+            comparison[f"pps_{size}"] = self.run_pps_test(packet_size)
+
+            bulk = threading.Thread(target=self.run_iperf3_test)
+            bulk.start()
+            latency = self.measure_latency()
+            bulk.join()
+            comparison[f"loaded_latency_us_{size}"] = latency["avg_latency_us"]
+            comparison[f"loaded_latency_p99_us_{size}"] = latency["99th_percentile_us"]
+
+        subprocess.run(["ethtool", "-G", iface, "rx", str(rx[1]), "tx", str(tx[1])],
+                       capture_output=True)
+
+        self.comparisons["ring_size"] = comparison
+        return comparison
+
+    def run_queue_reset_test(self, rounds: int = 16, packet_size: int = 64) -> Dict:
+        """
+        Reset queues one at a time under load, as failover does: recovery
+        time per reset from telemetry, and the pps a concurrent stream keeps
+        versus an undisturbed run.
+        """
+        print("Running per-queue reset test...")
+
+        comparison = {"baseline_pps": self.run_pps_test(packet_size)}
+        queues = len(self.read_telemetry_table("queue_reset_stats"))
+        if not queues:
+            print("queue_reset_stats telemetry not available")
+            return comparison
+
+        resets_before = self.sum_telemetry_column("queue_reset_stats", 1)
+        failed_before = self.sum_telemetry_column("queue_reset_stats", 2)
+        last_us = []
+        result = {}
+
+        pps_thread = threading.Thread(
+            target=lambda: result.update(pps=self.run_pps_test(packet_size)))
+        pps_thread.start()
+        for i in range(rounds):
+            qid = i % queues
+            try:
+                with open(f"{self.TELEMETRY_DIR}/queue_reset_stats", 'w') as f:
+                    f.write(str(qid))
+            except OSError as e:
+                print(f"Queue {qid} reset request failed: {e}")
+                break
+            time.sleep(self.duration / (rounds + 1))
+            row = self.read_telemetry_table("queue_reset_stats")[qid]
+            last_us.append(int(row[3]))
+        pps_thread.join()
+
+        comparison["resets"] = self.sum_telemetry_column("queue_reset_stats", 1) - resets_before
+        comparison["reset_failed"] = self.sum_telemetry_column("queue_reset_stats", 2) - failed_before
+        comparison["recovery_us_mean"] = statistics.mean(last_us) if last_us else 0
+        comparison["recovery_us_max"] = max(
+            (int(row[4]) for row in self.read_telemetry_table("queue_reset_stats")), default=0)
+        comparison["reset_pps"] = result.get("pps", 0)
+        if comparison["baseline_pps"]:
+            comparison["pps_loss_percent"] = (
+                1 - comparison["reset_pps"] / comparison["baseline_pps"]) * 100
+
+        self.comparisons["queue_reset"] = comparison
+        return comparison
+
+    def run_tx_steer_test(self, rounds: int = 8) -> Dict:
+        """
+        Packet continuity through queue failures: fail TX queues one at a
+        time under an 8-stream TCP load and compare throughput and
+        retransmits with an undisturbed run.  ndo_select_queue should move
+        traffic off each failed queue on the next packet.
+        """
+        print("Running failure-aware TX steering test...")
+
+        def summarize(data: Dict) -> Dict:
+            sent = data.get("end", {}).get("sum_sent", {})
+            return {"gbps": sent.get("bits_per_second", 0) / 1e9,
+                    "retransmits": sent.get("retransmits", 0)}
+
+        baseline = summarize(self.run_iperf3_test())
+        queues = len(self.read_telemetry_table("tx_steer_stats"))
+        if not queues:
+            print("tx_steer_stats telemetry not available")
+            return {}
+
+        steered_before = self.sum_telemetry_column("tx_steer_stats", 4)
+        result = {}
+
+        load = threading.Thread(target=lambda: result.update(self.run_iperf3_test()))
+        load.start()
+        for i in range(rounds):
+            time.sleep(self.duration / (rounds + 1))
+            try:
+                with open(f"{self.TELEMETRY_DIR}/tx_steer_stats", 'w') as f:
+                    f.write(str(i % queues))
+            except OSError as e:
+                print(f"Queue {i % queues} failure injection failed: {e}")
+                break
+        load.join()
+
+        failed = summarize(result)
+        comparison = {
+            "baseline_gbps": baseline["gbps"],
+            "baseline_retransmits": baseline["retransmits"],
+            "failover_gbps": failed["gbps"],
+            "failover_retransmits": failed["retransmits"],
+            "packets_steered": self.sum_telemetry_column("tx_steer_stats", 4) - steered_before,
+        }
+        if baseline["gbps"]:
+            comparison["throughput_loss_percent"] = (1 - failed["gbps"] / baseline["gbps"]) * 100
+
+        self.comparisons["tx_steer"] = comparison
+        return comparison
+
+    def compare_with_baseline(self, baseline_file: str) -> Dict:
+        """Percent change of each comparison metric against a previous report."""
+        try:
+            with open(baseline_file, 'r') as f:
+                baseline = json.load(f).get("comparisons", {})
+        except (OSError, json.JSONDecodeError) as e:
+            print(f"Failed to load baseline {baseline_file}: {e}")
+            return {}
+
+        deltas = {}
+        for test, metrics in self.comparisons.items():
+            for key, value in metrics.items():
+                before = baseline.get(test, {}).get(key)
+                if isinstance(value, (int, float)) and isinstance(before, (int, float)) and before:
+                    deltas[f"{test}.{key}"] = {
+                        "before": before,
+                        "after": value,
+                        "change_percent": (value / before - 1) * 100
+                    }
+        return deltas
+
     def validate_performance_targets(self) -> Dict:
         """Validate against performance targets."""
         targets = {
@@ -321,7 +976,7 @@ class VirtIONicBenchmark:
         
         return validation_results
     
-    def generate_report(self, output_file: str = None):
+    def generate_report(self, output_file: str = None, baseline_file: str = None):
         """Generate comprehensive benchmark report."""
         report = {
             "benchmark_info": {
@@ -343,6 +998,8 @@ class VirtIONicBenchmark:
                 }
                 for r in self.results
             ],
+            "comparisons": self.comparisons,
+            "baseline_delta": self.compare_with_baseline(baseline_file) if baseline_file else {},
             "validation": self.validate_performance_targets(),
             "summary": {
                 "max_throughput_gbps": max((r.throughput_gbps for r in self.results), default=0),
@@ -358,38 +1015,60 @@ class VirtIONicBenchmark:
         
         return report
 
+# Test name -> runner, in the order they run
+TESTS = {
+    "throughput": lambda b, args: b.run_throughput_test(),
+    "latency": lambda b, args: b.run_latency_test(),
+    "multi_az": lambda b, args: b.run_multi_az_test(),
+    "concurrent": lambda b, args: b.run_concurrent_test(),
+    "doorbell": lambda b, args: b.run_doorbell_test(),
+    "multiqueue_pps": lambda b, args: b.run_multiqueue_pps_test(),
+    "xdp_drop": lambda b, args: b.run_xdp_drop_test(args.xdp_iface, args.xdp_obj, args.pktgen_cmd),
+    "ring_layout": lambda b, args: b.run_ring_layout_test(args.iface),
+    "event_idx": lambda b, args: b.run_event_idx_test(args.iface),
+    "in_order": lambda b, args: b.run_in_order_test(args.iface),
+    "tx_copybreak": lambda b, args: b.run_tx_copybreak_test(args.iface),
+    "rx_copybreak": lambda b, args: b.run_rx_copybreak_test(args.iface),
+    "indirect_desc": lambda b, args: b.run_indirect_desc_test(args.iface),
+    "ctrl_batch": lambda b, args: b.run_ctrl_batch_test(args.iface),
+    "channels": lambda b, args: b.run_channels_test(args.iface),
+    "ring_size": lambda b, args: b.run_ring_size_test(args.iface),
+    "queue_reset": lambda b, args: b.run_queue_reset_test(),
+    "tx_steer": lambda b, args: b.run_tx_steer_test(),
+}
+
+# What "all" runs; the rest reload the driver or need extra setup, so only run when named
+ALL_TESTS = ("throughput", "latency", "multi_az", "concurrent", "doorbell", "multiqueue_pps")
+
 def main():
     parser = argparse.ArgumentParser(description="Comprehensive VirtIO NIC benchmark")
     parser.add_argument("--target", required=True, help="Target host for testing")
     parser.add_argument("--duration", type=int, default=30, help="Test duration in seconds")
     parser.add_argument("--output", help="Output file for results")
-    parser.add_argument("--tests", nargs="+", 
-                       choices=["throughput", "latency", "multi_az", "concurrent", "all"],
+    parser.add_argument("--hypervisor", help="Hypervisor host (ssh) for KVM exit counters")
+    parser.add_argument("--baseline", help="Earlier report to compare against (before/after a driver change)")
+    parser.add_argument("--xdp-iface", default="eth0", help="Guest interface for the XDP_DROP test")
+    parser.add_argument("--xdp-obj", default="xdp_drop.o", help="BPF object whose 'xdp' section returns XDP_DROP")
+    parser.add_argument("--pktgen-cmd", help="Command run on the hypervisor to blast the guest tap with pktgen")
+    parser.add_argument("--iface", default="eth0", help="Guest interface for tests that reload the driver")
+    parser.add_argument("--tests", nargs="+", choices=list(TESTS) + ["all"],
                        default=["all"], help="Tests to run")
     
     args = parser.parse_args()
     
-    benchmark = VirtIONicBenchmark(args.target, args.duration)
+    benchmark = VirtIONicBenchmark(args.target, args.duration, args.hypervisor)
     
     print(f"Starting VirtIO NIC benchmark against {args.target}")
     print(f"Duration: {args.duration} seconds")
     print(f"Tests: {args.tests}")
     
     try:
-        if "all" in args.tests or "throughput" in args.tests:
-            benchmark.run_throughput_test()
-        
-        if "all" in args.tests or "latency" in args.tests:
-            benchmark.run_latency_test()
-        
-        if "all" in args.tests or "multi_az" in args.tests:
-            benchmark.run_multi_az_test()
-        
-        if "all" in args.tests or "concurrent" in args.tests:
-            benchmark.run_concurrent_test()
+        for name, run in TESTS.items():
+            if name in args.tests or ("all" in args.tests and name in ALL_TESTS):
+                run(benchmark, args)
         
         # Generate report
-        report = benchmark.generate_report(args.output)
+        report = benchmark.generate_report(args.output, args.baseline)
         
         # Print summary
         print("\n" + "="*50)
@@ -0,0 +1,32 @@
+#include <kunit/test.h>
+#include "../../kernel/virtio_nic.h"
+
+static void hash_type_test(struct kunit *test)
+{
+    /* Port-inclusive reports let RFS trust the hash as a flow id */
+    KUNIT_EXPECT_EQ(test, virtio_nic_hash_type(VIRTIO_NET_HASH_REPORT_TCPv4), PKT_HASH_TYPE_L4);
+    KUNIT_EXPECT_EQ(test, virtio_nic_hash_type(VIRTIO_NET_HASH_REPORT_UDPv6), PKT_HASH_TYPE_L4);
+    KUNIT_EXPECT_EQ(test, virtio_nic_hash_type(VIRTIO_NET_HASH_REPORT_TCPv6_EX), PKT_HASH_TYPE_L4);
+
+    /* Address-only reports are L3 */
+    KUNIT_EXPECT_EQ(test, virtio_nic_hash_type(VIRTIO_NET_HASH_REPORT_IPv4), PKT_HASH_TYPE_L3);
+    KUNIT_EXPECT_EQ(test, virtio_nic_hash_type(VIRTIO_NET_HASH_REPORT_IPv6_EX), PKT_HASH_TYPE_L3);
+
+    /* No report, or one we do not know, leaves the skb unhashed */
+    KUNIT_EXPECT_EQ(test, virtio_nic_hash_type(VIRTIO_NET_HASH_REPORT_NONE), PKT_HASH_TYPE_NONE);
+    KUNIT_EXPECT_EQ(test, virtio_nic_hash_type(0xff), PKT_HASH_TYPE_NONE);
+}
+
+static struct kunit_case hash_report_cases[] = {
+    KUNIT_CASE(hash_type_test),
+    {}
+};
+
+static struct kunit_suite hash_report_suite = {
+    .name = "virtio_nic_hash_report",
+    .test_cases = hash_report_cases,
+};
+
+kunit_test_suite(hash_report_suite);
+
+MODULE_LICENSE("GPL");
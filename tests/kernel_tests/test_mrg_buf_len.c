@@ -0,0 +1,36 @@
+#include <kunit/test.h>
+#include <linux/cache.h>
+#include "../../kernel/virtio_nic.h"
+
+static void mrg_buf_len_test(struct kunit *test)
+{
+    const unsigned int hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+    unsigned int len;
+
+    /* Small packets still get room for a full frame */
+    len = virtio_nic_mrg_buf_len(64, hdr_len);
+    KUNIT_EXPECT_EQ(test, len, ALIGN(hdr_len + VIRTIO_NIC_GOOD_PACKET_LEN, L1_CACHE_BYTES));
+
+    /* Mid-sized averages are followed, rounded to a cache line */
+    len = virtio_nic_mrg_buf_len(2000, hdr_len);
+    KUNIT_EXPECT_EQ(test, len, ALIGN(hdr_len + 2000, L1_CACHE_BYTES));
+    KUNIT_EXPECT_TRUE(test, IS_ALIGNED(len, L1_CACHE_BYTES));
+
+    /* Large averages never exceed one page fragment */
+    len = virtio_nic_mrg_buf_len(65536, hdr_len);
+    KUNIT_EXPECT_LE(test, len, (unsigned int)VIRTIO_NIC_MRG_MAX_BUF_LEN);
+}
+
+static struct kunit_case mrg_buf_len_cases[] = {
+    KUNIT_CASE(mrg_buf_len_test),
+    {}
+};
+
+static struct kunit_suite mrg_buf_len_suite = {
+    .name = "virtio_nic_mrg_buf_len",
+    .test_cases = mrg_buf_len_cases,
+};
+
+kunit_test_suite(mrg_buf_len_suite);
+
+MODULE_LICENSE("GPL");
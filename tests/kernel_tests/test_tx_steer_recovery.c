@@ -0,0 +1,82 @@
+#include <kunit/test.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/rcupdate.h>
+#include "../../kernel/virtio_nic.h"
+
+static bool steered_around(struct virtio_nic_priv *priv, int queue_id)
+{
+    struct virtio_nic_tx_steer *steer;
+    bool failed;
+
+    rcu_read_lock();
+    steer = rcu_dereference(priv->tx_steer);
+    failed = steer && test_bit(queue_id, steer->failed);
+    rcu_read_unlock();
+
+    return failed;
+}
+
+/*
+ * Without a ring reset nothing else brings a failed queue back: the
+ * recovery window must return it to TX selection on its own.
+ */
+static void tx_steer_recovery_test(struct kunit *test)
+{
+    struct virtio_nic_failover_stats stats;
+    struct virtio_nic_priv *priv;
+    ktime_t now;
+
+    priv = kunit_kzalloc(test, sizeof(*priv), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, priv);
+    priv->vdev = kunit_kzalloc(test, sizeof(*priv->vdev), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, priv->vdev);
+    priv->num_queues = 2;
+    priv->active_queues = 2;
+    priv->queues = kunit_kcalloc(test, priv->num_queues, sizeof(*priv->queues), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, priv->queues);
+    spin_lock_init(&priv->tx_steer_lock);
+
+    virtio_nic_init_failover(priv);
+    KUNIT_ASSERT_NOT_NULL(test, priv->failover_state);
+
+    /* A timed-out queue is steered around and tracked as failed */
+    KUNIT_EXPECT_TRUE(test, virtio_nic_queue_mark_failed(priv, 1));
+    now = ktime_get();
+    KUNIT_EXPECT_TRUE(test, steered_around(priv, 1));
+    KUNIT_EXPECT_FALSE(test, steered_around(priv, 0));
+    virtio_nic_get_failover_stats(priv, &stats);
+    KUNIT_EXPECT_EQ(test, stats.failed_queues, 1);
+
+    /* Its flows go to the other queue, never back to itself */
+    KUNIT_EXPECT_EQ(test, virtio_nic_find_available_queue(priv, 1), 0);
+
+    /* Inside the window it stays failed and the work comes back later */
+    KUNIT_EXPECT_GT(test, virtio_nic_failover_recover(priv, now), 0);
+    KUNIT_EXPECT_TRUE(test, steered_around(priv, 1));
+
+    /* Past the window it is healthy again and the steering table is gone */
+    now = ktime_add_ms(now, VIRTIO_NIC_RECOVERY_WINDOW_MS + 1);
+    KUNIT_EXPECT_EQ(test, virtio_nic_failover_recover(priv, now), 0);
+    KUNIT_EXPECT_FALSE(test, steered_around(priv, 1));
+    KUNIT_EXPECT_NULL(test, rcu_access_pointer(priv->tx_steer));
+    virtio_nic_get_failover_stats(priv, &stats);
+    KUNIT_EXPECT_EQ(test, stats.failed_queues, 0);
+
+    virtio_nic_stop_failover(priv);
+    virtio_nic_cleanup_failover(priv);
+}
+
+static struct kunit_case tx_steer_recovery_cases[] = {
+    KUNIT_CASE(tx_steer_recovery_test),
+    {}
+};
+
+static struct kunit_suite tx_steer_recovery_suite = {
+    .name = "virtio_nic_tx_steer_recovery",
+    .test_cases = tx_steer_recovery_cases,
+};
+
+kunit_test_suite(tx_steer_recovery_suite);
+
+MODULE_LICENSE("GPL");